@@ -1,116 +1,589 @@
+#define _DEFAULT_SOURCE  /* lgamma_r */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 /* ----------------- Simulation Parameters ----------------- */
 
-#define NUM_HOUSES        100
-#define NUM_WORKPLACES    20
-#define NUM_BREEDINGSITES 50
+/* Every model parameter is read at runtime so one prebuilt binary can serve
+   every request. The values below are only the defaults; override them with
+   command line flags (--humans 20000) or a parameter file (--params run.txt)
+   holding one "key = value" per line. */
 
-#define NUM_HUMANS        10000
-#define NUM_MOSQUITOES    10000
-
-#define DAYS              500
 #define HOURS_PER_DAY     24
+#define DAYS_PER_WEEK     7
+#define HOURS_PER_WEEK    (DAYS_PER_WEEK * HOURS_PER_DAY)
+
+#define OCCUPANT_MIN_CAPACITY 4
+
+#define RECOVERY_DELAY_DAYS 14  /* Infected humans cannot recover before this */
+#define CALENDAR_DAYS     64    /* Day buckets in the transition calendar ring */
+
+/* How infectious mosquitoes infect the humans sharing their node */
+typedef enum {
+    KERNEL_MOSQUITO,  /* Each biting mosquito draws against every susceptible human */
+    KERNEL_NODE       /* Biters are pooled per node; each human is drawn once per hour */
+} InfectionKernel;
+
+const char *const infectionKernelNames[] = { "mosquito", "node", NULL };
+
+/* How the mosquito population is represented */
+typedef enum {
+    MOSQ_AGENTS,      /* One record per mosquito */
+    MOSQ_COUNTS       /* Per-node counts by state and exposure day, see Mosquito Swarms */
+} MosquitoModel;
 
-#define MAX_OCCUPANTS     200
+const char *const mosquitoModelNames[] = { "agents", "counts", NULL };
 
-#define DAILY_BITING_PROB 0.3
-#define B_MOS_TO_HUMAN    0.2
-#define C_HUMAN_TO_MOS    0.1
-#define HUMAN_RECOVERY    (1.0/14.0)
-#define MOSQ_MORTALITY    0.1
-#define TAU_M             10
-#define HUMAN_MORTALITY   0.0001
+/* How simulated time advances, see Event Engines */
+typedef enum {
+    ENGINE_HOURLY,        /* Fixed hourly steps */
+    ENGINE_NEXT_REACTION, /* Exact continuous time, counts model only */
+    ENGINE_TAU_LEAP,      /* Steps of several hours where nothing forces a stop, counts model only */
+    ENGINE_PHASED         /* One step per phase of the day, exposure integrated over it, counts model only */
+} Engine;
+
+const char *const engineNames[] = { "hourly", "next-reaction", "tau-leap", "phased", NULL };
+
+/* Which result files are written, see Output */
+typedef enum {
+    OUTPUT_CSV,       /* global_stats.csv and house_infected.csv */
+    OUTPUT_BINARY,    /* results.bin, columnar */
+    OUTPUT_BOTH,      /* All three */
+    OUTPUT_DELTA      /* global_stats.csv, houses.csv and house_changes.bin */
+} OutputFormat;
 
-/* NEW: Spatial and intervention parameters */
-#define GRID_SIZE         100
-#define DISTANCE_FACTOR   0.1  /* β parameter for distance-based probability */
+const char *const outputFormatNames[] = { "csv", "binary", "both", "delta", NULL };
 
-/* Simplified intervention parameters */
-#define ITN_COVERAGE      0.1
-#define ITN_EFFICACY       0.7
-#define ITN_KILL_PROB      0.3
+const char *const switchNames[] = { "off", "on", NULL };
 
-#define TREATMENT_RATE     0.1
-#define TREATMENT_EFFECT   0.5
+typedef struct {
+    int    numHouses;
+    int    numWorkplaces;
+    int    numBreedingSites;
+
+    int    numHumans;
+    int    humanWeight;       /* People per human agent at the start */
+    int    splitWeight;       /* Most people per agent split off by infection */
+    int    numMosquitoes;
+    int    mosqMinAlive;      /* Repopulation floor for living mosquitoes */
+    int    initialInfectedHumans;
+    int    initialInfectedMosquitoes;
+
+    int    days;
+
+    double dailyBitingProb;
+    double bMosToHuman;
+    double cHumanToMos;
+    double humanRecovery;
+    double mosqMortality;
+    int    tauM;
+    double humanMortality;
+    double mosqMoveChance;
+
+    /* Human daily routine. Each worker gets a shift shifted by up to
+       shiftSpread hours either way; a shift ending at or before its start
+       runs overnight. Weekend days are the last days of each 7-day week. */
+    int    workStart;
+    int    workEnd;
+    int    shiftSpread;
+    double nonWorkerFrac;
+    int    weekendDays;
+
+    /* Spatial and intervention parameters */
+    double gridSize;
+    double distanceFactor;    /* β parameter for distance-based probability */
+    double dispersalCutoff;   /* Truncate the kernel beyond this distance, 0 for none */
+    int    dispersalMaxDest;  /* Keep only this many nearest destinations, 0 for all */
+
+    double itnCoverage;
+    double itnEfficacy;
+    double itnKillProb;
+
+    double treatmentRate;
+    double treatmentEffect;
+
+    int    infectionKernel;   /* InfectionKernel */
+    int    mosquitoModel;     /* MosquitoModel */
+    int    engine;            /* Engine */
+    int    leapHours;         /* Longest tau-leap step */
+
+    int    outputFormat;      /* OutputFormat */
+    int    keyframeDays;      /* Delta output: full house row every this many days */
+    int    outputQueueDays;   /* Days queued for the output thread, 0 to write inline */
+
+    int    threads;           /* Worker threads for the simulation steps */
+    int    deterministic;     /* Same results for any thread count, see unitRng() */
+
+    uint64_t seed;            /* 0 picks one from the clock; the seed used is printed */
+} SimParams;
+
+SimParams params = {
+    .numHouses        = 100,
+    .numWorkplaces    = 20,
+    .numBreedingSites = 50,
+
+    .numHumans        = 10000,
+    .humanWeight      = 1,
+    .splitWeight      = 1,
+    .numMosquitoes    = 10000,
+    .mosqMinAlive     = 5000,
+    .initialInfectedHumans     = 10,
+    .initialInfectedMosquitoes = 100,
+
+    .days             = 500,
+
+    .dailyBitingProb  = 0.3,
+    .bMosToHuman      = 0.2,
+    .cHumanToMos      = 0.1,
+    .humanRecovery    = 1.0/14.0,
+    .mosqMortality    = 0.1,
+    .tauM             = 10,
+    .humanMortality   = 0.0001,
+    .mosqMoveChance   = 0.1,
+
+    .workStart        = 8,
+    .workEnd          = 18,
+    .shiftSpread      = 0,
+    .nonWorkerFrac    = 0.0,
+    .weekendDays      = 0,
+
+    .gridSize         = 100,
+    .distanceFactor   = 0.1,
+    .dispersalCutoff  = 0,
+    .dispersalMaxDest = 0,
+
+    .itnCoverage      = 0.1,
+    .itnEfficacy      = 0.7,
+    .itnKillProb      = 0.3,
+
+    .treatmentRate    = 0.1,
+    .treatmentEffect  = 0.5,
+
+    .infectionKernel  = KERNEL_MOSQUITO,
+    .mosquitoModel    = MOSQ_AGENTS,
+    .engine           = ENGINE_HOURLY,
+    .leapHours        = 6,
+
+    .outputFormat     = OUTPUT_CSV,
+    .keyframeDays     = 30,
+    .outputQueueDays  = 8,
+
+    .threads          = 1,
+    .deterministic    = 1,
+
+    .seed             = 0
+};
+
+/* Derived once the parameters are known */
+double hourlyBitingProb;
+double stepBiteProb, stepMoveProb;    /* Counts model: per mosquito over one step */
+double biteLogQ, moveLogQ;            /* Sparse sampling of hourly events */
+double humanDeathLogQ, mosqDeathLogQ; /* Sparse sampling of daily deaths */
+double recoveryLogQ, treatedRecoveryLogQ;
+
+typedef enum { PARAM_INT, PARAM_DOUBLE, PARAM_CHOICE, PARAM_U64 } ParamType;
 
-#define HOURLY_BITING_PROB (DAILY_BITING_PROB / (double)HOURS_PER_DAY)
-#define MOSQ_MOVE_CHANCE  0.1
+typedef struct {
+    const char *name;
+    ParamType   type;
+    void       *value;
+    const char *const *choices; /* PARAM_CHOICE: NULL-terminated names, stored as the index */
+} ParamSpec;
+
+/* Flag names double as parameter file keys ("--humans 500" or "humans = 500") */
+ParamSpec paramSpecs[] = {
+    { "houses",             PARAM_INT,    &params.numHouses },
+    { "workplaces",         PARAM_INT,    &params.numWorkplaces },
+    { "breeding-sites",     PARAM_INT,    &params.numBreedingSites },
+    { "humans",             PARAM_INT,    &params.numHumans },
+    { "human-weight",       PARAM_INT,    &params.humanWeight },
+    { "split-weight",       PARAM_INT,    &params.splitWeight },
+    { "mosquitoes",         PARAM_INT,    &params.numMosquitoes },
+    { "mosq-min-alive",     PARAM_INT,    &params.mosqMinAlive },
+    { "initial-infected-humans",     PARAM_INT, &params.initialInfectedHumans },
+    { "initial-infected-mosquitoes", PARAM_INT, &params.initialInfectedMosquitoes },
+    { "days",               PARAM_INT,    &params.days },
+    { "biting-prob",        PARAM_DOUBLE, &params.dailyBitingProb },
+    { "b-mos-to-human",     PARAM_DOUBLE, &params.bMosToHuman },
+    { "c-human-to-mos",     PARAM_DOUBLE, &params.cHumanToMos },
+    { "human-recovery",     PARAM_DOUBLE, &params.humanRecovery },
+    { "mosq-mortality",     PARAM_DOUBLE, &params.mosqMortality },
+    { "tau-m",              PARAM_INT,    &params.tauM },
+    { "human-mortality",    PARAM_DOUBLE, &params.humanMortality },
+    { "mosq-move-chance",   PARAM_DOUBLE, &params.mosqMoveChance },
+    { "work-start",         PARAM_INT,    &params.workStart },
+    { "work-end",           PARAM_INT,    &params.workEnd },
+    { "shift-spread",       PARAM_INT,    &params.shiftSpread },
+    { "non-worker-frac",    PARAM_DOUBLE, &params.nonWorkerFrac },
+    { "weekend-days",       PARAM_INT,    &params.weekendDays },
+    { "grid-size",          PARAM_DOUBLE, &params.gridSize },
+    { "distance-factor",    PARAM_DOUBLE, &params.distanceFactor },
+    { "dispersal-cutoff",   PARAM_DOUBLE, &params.dispersalCutoff },
+    { "dispersal-max-dest", PARAM_INT,    &params.dispersalMaxDest },
+    { "itn-coverage",       PARAM_DOUBLE, &params.itnCoverage },
+    { "itn-efficacy",       PARAM_DOUBLE, &params.itnEfficacy },
+    { "itn-kill-prob",      PARAM_DOUBLE, &params.itnKillProb },
+    { "treatment-rate",     PARAM_DOUBLE, &params.treatmentRate },
+    { "treatment-effect",   PARAM_DOUBLE, &params.treatmentEffect },
+    { "infection-kernel",   PARAM_CHOICE, &params.infectionKernel, infectionKernelNames },
+    { "mosquito-model",     PARAM_CHOICE, &params.mosquitoModel, mosquitoModelNames },
+    { "engine",             PARAM_CHOICE, &params.engine, engineNames },
+    { "leap-hours",         PARAM_INT,    &params.leapHours },
+    { "output-format",      PARAM_CHOICE, &params.outputFormat, outputFormatNames },
+    { "keyframe-days",      PARAM_INT,    &params.keyframeDays },
+    { "output-queue-days",  PARAM_INT,    &params.outputQueueDays },
+    { "threads",            PARAM_INT,    &params.threads },
+    { "deterministic",      PARAM_CHOICE, &params.deterministic, switchNames },
+    { "seed",               PARAM_U64,    &params.seed }
+};
+
+#define NUM_PARAM_SPECS ((int)(sizeof(paramSpecs) / sizeof(paramSpecs[0])))
 
 typedef enum {
     STATE_S,
     STATE_I,
-    STATE_R
+    STATE_R,
+    STATE_DEAD
 } HumanState;
 
 typedef enum {
     MSTATE_S,
     MSTATE_E,
-    MSTATE_I
+    MSTATE_I,
+    MSTATE_DEAD
 } MosqState;
 
+#define NUM_NETWORKS      3     /* Houses, workplaces, breeding sites */
+#define NET_NONE          0xFF  /* Agent is not placed in any network */
+
+/* Human flag bits */
+#define HUMAN_HAS_ITN     0x01
+#define HUMAN_TREATED     0x02
+
+/* Growable list of agent array indices. Capacity doubles on demand and halves
+   once the list is mostly empty, so memory follows the actual occupancy. */
 typedef struct {
-    int occupantIDs[MAX_OCCUPANTS];
-    int occupantCount;
+    int *ids;
+    int  count;
+    int  capacity;
+} OccupantList;
+
+typedef struct {
+    OccupantList humans;     /* Indices into the human table */
+    OccupantList mosquitoes; /* Indices into the mosquito table */
+    /* Occupants by state, kept up to date on every move and transition */
+    int humanStates[STATE_DEAD];   /* S, I, R */
+    int mosqStates[MSTATE_DEAD];   /* S, E, I */
+    int infectiousTreated;   /* Infectious humans under treatment, which transmit less */
+    int treated;             /* Humans with HUMAN_TREATED */
+    int netted;              /* Humans with HUMAN_HAS_ITN */
     /* Spatial coordinates */
     double x, y;
     /* ITN protection status */
     int has_ITN;
 } Node;
 
+/* One column of a Walker alias table: keep column k with probability prob,
+   otherwise take alias */
+typedef struct {
+    float prob;
+    int   alias;
+} AliasEntry;
+
+/* Alias tables for moves from every origin node into one network, by
+   origin: origin o's candidate destinations are ids[start[o] .. start[o+1])
+   and its table is table[] over the same range */
+typedef struct {
+    long       *start;    /* [numNodes + 1] */
+    int        *ids;      /* Destination node within the network */
+    AliasEntry *table;
+    float      *share;    /* Normalised weights, counts mosquito model only */
+} DestTable;
+
+/* A state transition due at the end of `day`. It is dropped when it comes
+   up if the agent has since left the state, or for mosquitoes, if the slot
+   has been reused (generation no longer matches). */
+typedef struct {
+    int      agent;
+    int32_t  day;
+    uint32_t generation;
+} Event;
+
+typedef struct {
+    Event *items;
+    int    count;
+    int    capacity;
+} EventList;
+
+/* Ring of day buckets: an event lands in bucket day % CALENDAR_DAYS and
+   waits there for as many laps as it needs */
+typedef struct {
+    EventList recoveries[CALENDAR_DAYS];   /* Human I -> R */
+    EventList incubations[CALENDAR_DAYS];  /* Mosquito E -> I */
+} Calendar;
+
+/* Agents are stored as structs of arrays indexed by agent number. The hot
+   fields are the narrow ones the hourly sweeps stream through (state, flags,
+   location); the cold fields are only touched on transitions and at setup.
+
+   A human agent may be a super-individual: `weight` people who share a
+   home, a workplace, a schedule and a state. The node counters, and with
+   them infection pressure and the daily stats, count people, not agents.
+   Infection splits the infected off into agents of their own, see
+   infectGroup(). */
 typedef struct {
-    int        id;
-    HumanState state;
-    int        infectedDay;
-    int        age;
-    int        homeNet,  homeNode;
-    int        workNet,  workNode;
-    int        currentNet, currentNode;
-    /* Intervention status */
-    int        has_ITN;
-    int        under_treatment;
-    int        treatment_day;
-} Human;
+    /* Hot */
+    uint8_t  *state;         /* HumanState */
+    uint8_t  *flags;         /* HUMAN_HAS_ITN | HUMAN_TREATED */
+    uint32_t *weight;        /* People this agent stands for */
+    uint8_t  *net;           /* Current network, NET_NONE when not placed */
+    uint32_t *node;          /* Current node within that network */
+    uint32_t *slot;          /* Position in the current node's occupant list */
+    /* Cold */
+    int32_t  *infectedDay;
+    int32_t  *treatmentDay;
+    uint8_t  *age;
+    uint8_t  *homeNet,  *workNet;
+    uint32_t *homeNode, *workNode;
+    uint8_t  *workStart, *workEnd;  /* Hours of day */
+    uint8_t  *workDays;             /* Bit d set: works on day d of the week */
+} HumanTable;
 
 typedef struct {
-    int       id;
-    MosqState state;
-    int       exposedDay;
-    int       age;
-    int       breedNet, breedNode;
-    int       currentNet, currentNode;
-} Mosquito;
-
-/* Global arrays & structures */
-Node houses[NUM_HOUSES];
-Node workplaces[NUM_WORKPLACES];
-Node breedingSites[NUM_BREEDINGSITES];
-
-Human     humans[NUM_HUMANS];
-Mosquito  mosquitoes[NUM_MOSQUITOES];
+    /* Hot */
+    uint8_t  *state;         /* MosqState */
+    uint8_t  *net;
+    uint32_t *node;
+    uint32_t *slot;
+    /* Cold */
+    uint32_t *generation;    /* Bumped every time the slot is reused, lets the calendar drop stale events */
+    int32_t  *exposedDay;
+    uint8_t  *age;
+    uint8_t  *breedNet;
+    uint32_t *breedNode;
+} MosquitoTable;
+
+/* Global arrays & structures, sized from params in allocateSimulation().
+   All nodes live in one block; the three networks are views into it. */
+Node *nodes;
+Node *houses;
+Node *workplaces;
+Node *breedingSites;
+int   numNodes;
+
+HumanTable    humans;
+MosquitoTable mosquitoes;
+int           humanCount;     /* Human agents, dead ones included */
+int           humanCapacity;
+
+/* Dead mosquito slots waiting to be reused, kept as a stack */
+int *mosqFreeSlots;
+int  mosqFreeCount;
+int  mosqAlive;
+
+/* Counts mosquito model: exposed mosquitoes by node and exposure day,
+   swarmCohorts[node * cohortDays + exposedDay % cohortDays] */
+int *swarmCohorts;
+int  cohortDays;
+
+/* One transition calendar per worker thread, so scheduling needs no locks */
+Calendar *calendars;
+
+/* Houses with bed nets, for the hourly eviction sweep */
+int *itnHouses, numItnHouses;
+
+/* Departure wheel: for each hour of the week, the humans whose schedule may
+   take them somewhere else at that hour, in ascending index order. Slot s
+   holds wheelHumans[wheelStart[s] .. wheelStart[s+1]). */
+int *wheelStart;
+int *wheelHumans;
+
+/* Humans split off since the wheel was built, in index order. They are
+   checked every hour until the weekly compaction folds them in. */
+int *wheelPending;
+int  numWheelPending, wheelPendingCapacity;
+int  pendingDepartures[HOURS_PER_WEEK];  /* Departures of the pending humans by hour */
 
 int day   = 0;
 int hour  = 0;
 
-/* We'll keep daily stats in arrays for in-memory use, then write them out after sim. */
-int S_history[DAYS], I_history[DAYS], R_history[DAYS];
-int E_history[DAYS], IM_history[DAYS], total_history[DAYS];
+/* ----------------- Utility Functions ----------------- */
 
-/* House-level time-series: house_infected_series[day][house_id].
-   We'll store them in memory and then export to CSV. */
-int house_infected_series[DAYS][NUM_HOUSES];
+void* allocOrDie(size_t count, size_t size) {
+    void *p = calloc(count ? count : 1, size);
+    if(!p) {
+        fprintf(stderr, "Out of memory allocating %zu x %zu bytes\n", count, size);
+        exit(1);
+    }
+    return p;
+}
 
-/* Intervention tracking */
-int itn_protected[DAYS];
-int treatment_count[DAYS];
+void* reallocOrDie(void *p, size_t count, size_t size) {
+    p = realloc(p, (count ? count : 1) * size);
+    if(!p) {
+        fprintf(stderr, "Out of memory growing to %zu x %zu bytes\n", count, size);
+        exit(1);
+    }
+    return p;
+}
 
-/* ----------------- Utility Functions ----------------- */
+/* ----------------- Random Numbers ----------------- */
+
+/* All randomness goes through explicit Rng streams (xoshiro256**), seeded
+   from --seed, so a run is reproducible bit for bit from its seed and does
+   not depend on the platform's rand(). Independent streams are derived by
+   hashing (seed, stream key) with splitmix64, which makes them
+   counter-based: any stream can be recreated directly from its key, e.g.
+   per agent or per thread. rngJump() skips a stream ahead by 2^128 draws. */
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+Rng simRng; /* Stream for setup and the serial parts of each step */
+
+uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Seed r as stream number `stream` of the generator family for `seed` */
+void rngSeed(Rng *r, uint64_t seed, uint64_t stream) {
+    uint64_t x = seed ^ splitmix64(&stream);
+    for(int i=0; i<4; i++) r->s[i] = splitmix64(&x);
+}
+
+static inline uint64_t rotl64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+uint64_t rngNext(Rng *r) {
+    uint64_t *s = r->s;
+    uint64_t result = rotl64(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl64(s[3], 45);
+    return result;
+}
+
+/* Advance r by 2^128 draws, giving a non-overlapping substream */
+void rngJump(Rng *r) {
+    static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                     0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for(int i=0; i<4; i++){
+        for(int b=0; b<64; b++){
+            if(JUMP[i] & (1ULL << b)) {
+                s0 ^= r->s[0]; s1 ^= r->s[1]; s2 ^= r->s[2]; s3 ^= r->s[3];
+            }
+            rngNext(r);
+        }
+    }
+    r->s[0] = s0; r->s[1] = s1; r->s[2] = s2; r->s[3] = s3;
+}
+
+/* Uniform on [0, 1) */
+double rngDouble(Rng *r) {
+    return (rngNext(r) >> 11) * 0x1.0p-53;
+}
+
+/* Uniform on (0, 1], safe to take the log of */
+double rngOpenDouble(Rng *r) {
+    return ((rngNext(r) >> 11) + 1) * 0x1.0p-53;
+}
+
+/* Uniform integer in [0, n) without modulo bias */
+uint32_t rngBelow(Rng *r, uint32_t n) {
+    uint64_t m = (rngNext(r) >> 32) * (uint64_t)n;
+    if((uint32_t)m < n) {
+        uint32_t threshold = -n % n;
+        while((uint32_t)m < threshold) m = (rngNext(r) >> 32) * (uint64_t)n;
+    }
+    return (uint32_t)(m >> 32);
+}
+
+/* Sparse Bernoulli sampling. Rather than drawing a Bernoulli(p) for every one
+   of n items, jump straight to the next item that fires: the gap between
+   successes is geometric, so cost scales with events instead of items.
+   logQ is log(1 - p); iterate with
+       for(long i = nextFiring(r, -1, n, logQ); i < n; i = nextFiring(r, i, n, logQ))
+   Returns n once no further item fires. */
+long nextFiring(Rng *r, long i, long n, double logQ) {
+    if(!(logQ < 0.0)) return n;               /* p <= 0: nothing ever fires */
+    double skip = log(rngOpenDouble(r)) / logQ;   /* >= 0, so never behind i */
+    if(skip >= (double)(n - i - 1)) return n;
+    return i + 1 + (long)skip;
+}
+
+/* logQ for a chance p, clamped to [0, 1] like a plain rngDouble() < p test */
+double sparseLogQ(double p) {
+    if(!(p > 0.0)) return 0.0;
+    return log1p(-fmin(p, 1.0));
+}
+
+/* log(k!). lgamma() writes the global signgam, which races between
+   workers, so use the reentrant form */
+double logFactorial(double k) {
+    int sign;
+    return lgamma_r(k + 1.0, &sign);
+}
+
+/* Binomial(n, p). Small means are drawn by inversion, large ones by
+   Hormann's transformed rejection with squeeze (BTRS), which takes about
+   one and a half pairs of uniforms whatever n is. Draws for p > 0.5 are
+   taken as n minus a draw for 1 - p. */
+long rngBinomial(Rng *r, long n, double p) {
+    if(n <= 0 || p <= 0.0) return 0;
+    if(p >= 1.0) return n;
+    if(p > 0.5) return n - rngBinomial(r, n, 1.0 - p);
+
+    double q = 1.0 - p;
+    if(n * p < 10.0) {
+        /* Walk up the CDF from 0 */
+        double s = p / q, a = (n + 1) * s, f = pow(q, (double)n);
+        double u = rngDouble(r);
+        long x = 0;
+        while(u > f && x < n) {
+            u -= f;
+            x++;
+            f *= a / x - s;
+        }
+        return x;
+    }
 
-double randDouble() {
-    return (double)rand() / (double)RAND_MAX;
+    double spq   = sqrt(n * p * q);
+    double b     = 1.15 + 2.53 * spq;
+    double a     = -0.0873 + 0.0248 * b + 0.01 * p;
+    double c     = n * p + 0.5;
+    double vr    = 0.92 - 4.2 / b;
+    double alpha = (2.83 + 5.1 / b) * spq;
+    double lpq   = log(p / q);
+    double m     = floor((n + 1) * p);
+    double h     = logFactorial(m) + logFactorial(n - m);
+    for(;;) {
+        double u  = rngDouble(r) - 0.5;
+        double v  = rngDouble(r);
+        double us = 0.5 - fabs(u);
+        double k  = floor((2.0 * a / us + b) * u + c);
+        if(k < 0 || k > n) continue;
+        if(us >= 0.07 && v <= vr) return (long)k;
+        v = log(v * alpha / (a / (us * us) + b));
+        if(v <= h - logFactorial(k) - logFactorial(n - k) + (k - m) * lpq) return (long)k;
+    }
 }
 
 Node* getNode(int netID, int nodeID) {
@@ -118,51 +591,257 @@ Node* getNode(int netID, int nodeID) {
         case 0: return &houses[nodeID];       /* Houses */
         case 1: return &workplaces[nodeID];   /* Workplaces */
         case 2: return &breedingSites[nodeID];/* BreedingSites */
-        default: return ;
+        default: return NULL;
     }
 }
 
-void addAgent(Node *node, int agentID) {
-    if (node->occupantCount < MAX_OCCUPANTS) {
-        node->occupantIDs[node->occupantCount] = agentID;
-        node->occupantCount++;
+/* Position of (netID, nodeID) in the shared nodes block */
+int nodeIndex(int netID, int nodeID) {
+    return (int)(getNode(netID, nodeID) - nodes);
+}
+
+void resizeOccupants(OccupantList *list, int capacity) {
+    list->ids      = reallocOrDie(list->ids, capacity, sizeof(int));
+    list->capacity = capacity;
+}
+
+/* Give memory back once the list is mostly empty */
+void shrinkOccupants(OccupantList *list) {
+    if(list->capacity > OCCUPANT_MIN_CAPACITY && list->count < list->capacity / 4) {
+        resizeOccupants(list, list->capacity / 2);
     }
 }
 
-void removeAgent(Node *node, int agentID) {
-    int foundIndex = -1;
-    for(int i=0; i<node->occupantCount; i++){
-        if(node->occupantIDs[i] == agentID){
-            foundIndex = i;
-            break;
-        }
+/* Append an agent index and return the slot it landed in */
+int addAgent(OccupantList *list, int agentIdx) {
+    if(list->count == list->capacity) {
+        resizeOccupants(list, list->capacity ? list->capacity * 2 : OCCUPANT_MIN_CAPACITY);
+    }
+    list->ids[list->count] = agentIdx;
+    return list->count++;
+}
+
+/* Swap-remove the entry at slot. Returns the agent index moved into slot to
+   fill the gap (its owner must update its slot), or -1 if slot was the last. */
+int removeAgent(OccupantList *list, int slot) {
+    int moved = -1;
+    list->count--;
+    if(slot != list->count) {
+        moved = list->ids[list->count];
+        list->ids[slot] = moved;
+    }
+    shrinkOccupants(list);
+    return moved;
+}
+
+/* Add (delta = 1) or remove (delta = -1) human i's contribution to the
+   counters of the node it occupies: one per person it stands for */
+void countHuman(Node *node, int i, int delta) {
+    int flags = humans.flags[i];
+    delta *= (int)humans.weight[i];
+    node->humanStates[humans.state[i]] += delta;
+    if(flags & HUMAN_TREATED) node->treated += delta;
+    if(flags & HUMAN_HAS_ITN) node->netted  += delta;
+    if(humans.state[i] == STATE_I && (flags & HUMAN_TREATED)) node->infectiousTreated += delta;
+}
+
+/* Infectious humans at a node weighted by how well they transmit */
+double infectiousWeight(const Node *node) {
+    return (node->humanStates[STATE_I] - node->infectiousTreated)
+         + node->infectiousTreated * (1.0 - params.treatmentEffect);
+}
+
+/* Change a human's state and set addFlags, keeping the counters of its node in step */
+void setHumanState(int i, int newState, int addFlags) {
+    Node *node = humans.net[i] == NET_NONE ? NULL : getNode(humans.net[i], humans.node[i]);
+    if(node) countHuman(node, i, -1);
+    humans.state[i] = newState;
+    humans.flags[i] |= addFlags;
+    if(node) countHuman(node, i, 1);
+}
+
+/* Change how many people human i stands for, keeping its node's counters in step */
+void setHumanWeight(int i, int weight) {
+    Node *node = humans.net[i] == NET_NONE ? NULL : getNode(humans.net[i], humans.node[i]);
+    if(node) countHuman(node, i, -1);
+    humans.weight[i] = weight;
+    if(node) countHuman(node, i, 1);
+}
+
+/* Take a human out of its current node, e.g. before moving or on death */
+void detachHuman(int i) {
+    if(humans.net[i] == NET_NONE) return;
+    Node *oldNode = getNode(humans.net[i], humans.node[i]);
+    int moved = removeAgent(&oldNode->humans, humans.slot[i]);
+    if(moved >= 0) humans.slot[moved] = humans.slot[i];
+    countHuman(oldNode, i, -1);
+
+    humans.net[i] = NET_NONE;
+}
+
+/* Place a detached human at (newNet, newNode) */
+void attachHuman(int i, int newNet, int newNode) {
+    Node *node = getNode(newNet, newNode);
+    humans.slot[i] = addAgent(&node->humans, i);
+    countHuman(node, i, 1);
+
+    humans.net[i]  = newNet;
+    humans.node[i] = newNode;
+}
+
+void moveHuman(int i, int newNet, int newNode) {
+    detachHuman(i);
+    attachHuman(i, newNet, newNode);
+}
+
+/* Mosquito occupant lists are kept in segments by state:
+       [ S ... | I ... | E ... ]
+   The segment sizes are the node's mosqStates counters, so the infection
+   phase can sample biters from just the susceptible or just the infectious
+   segment, and exposed mosquitoes, which can neither infect nor be infected,
+   are never visited there. Keeping the order costs at most one extra move
+   per later segment on insert and erase. */
+#define NUM_SEGMENTS      3
+
+const int segmentState[NUM_SEGMENTS] = { MSTATE_S, MSTATE_I, MSTATE_E };
+
+int segmentOf(int state) {
+    return state == MSTATE_S ? 0 : state == MSTATE_I ? 1 : 2;
+}
+
+/* First position of segment seg, or the list length for seg == NUM_SEGMENTS */
+int segmentStart(const Node *node, int seg) {
+    int start = 0;
+    for(int k=0; k<seg; k++) start += node->mosqStates[segmentState[k]];
+    return start;
+}
+
+void placeMosquito(OccupantList *list, int pos, int i) {
+    list->ids[pos]     = i;
+    mosquitoes.slot[i] = pos;
+}
+
+/* Add mosquito i to its state's segment: each later segment hands its first
+   entry to its end, opening a hole at the right place */
+void insertMosquito(Node *node, int i) {
+    OccupantList *list = &node->mosquitoes;
+    int seg = segmentOf(mosquitoes.state[i]);
+
+    if(list->count == list->capacity) {
+        resizeOccupants(list, list->capacity ? list->capacity * 2 : OCCUPANT_MIN_CAPACITY);
     }
-    if(foundIndex != -1){
-        node->occupantIDs[foundIndex] = node->occupantIDs[node->occupantCount - 1];
-        node->occupantCount--;
+    int hole = list->count++;
+    for(int k=NUM_SEGMENTS-1; k>seg; k--){
+        int first = segmentStart(node, k);
+        if(first != hole) placeMosquito(list, hole, list->ids[first]);
+        hole = first;
     }
+    placeMosquito(list, hole, i);
+    node->mosqStates[mosquitoes.state[i]]++;
 }
 
-void moveHuman(Human *h, int newNet, int newNode) {
-    if(h->currentNet >= 0 && h->currentNode >= 0) {
-        Node* oldNode = getNode(h->currentNet, h->currentNode);
-        removeAgent(oldNode, h->id);
+/* Remove mosquito i: the hole it leaves is filled from the end of its
+   segment, and passed on through each later segment */
+void eraseMosquito(Node *node, int i) {
+    OccupantList *list = &node->mosquitoes;
+    int hole = mosquitoes.slot[i];
+
+    for(int k=segmentOf(mosquitoes.state[i]); k<NUM_SEGMENTS; k++){
+        int last = segmentStart(node, k + 1) - 1;
+        if(last != hole) placeMosquito(list, hole, list->ids[last]);
+        hole = last;
     }
-    addAgent(getNode(newNet, newNode), h->id);
+    list->count--;
+    node->mosqStates[mosquitoes.state[i]]--;
+    shrinkOccupants(list);
+}
+
+void setMosquitoState(int i, int newState) {
+    Node *node = mosquitoes.net[i] == NET_NONE ? NULL : getNode(mosquitoes.net[i], mosquitoes.node[i]);
+    if(node) eraseMosquito(node, i);
+    mosquitoes.state[i] = newState;
+    if(node) insertMosquito(node, i);
+}
+
+void detachMosquito(int i) {
+    if(mosquitoes.net[i] == NET_NONE) return;
+    eraseMosquito(getNode(mosquitoes.net[i], mosquitoes.node[i]), i);
+
+    mosquitoes.net[i] = NET_NONE;
+}
+
+void attachMosquito(int i, int newNet, int newNode) {
+    insertMosquito(getNode(newNet, newNode), i);
+
+    mosquitoes.net[i]  = newNet;
+    mosquitoes.node[i] = newNode;
+}
+
+void moveMosquito(int i, int newNet, int newNode) {
+    detachMosquito(i);
+    attachMosquito(i, newNet, newNode);
+}
+
+/* Hand the slot of a dead, detached mosquito back for reuse. Serial only. */
+void releaseMosquitoSlot(int i) {
+    mosqFreeSlots[mosqFreeCount++] = i;
+    mosqAlive--;
+}
+
+/* Bring a new susceptible mosquito to life in a free slot at a breeding site.
+   Returns the slot, or -1 when every slot is in use. */
+int spawnMosquito(Rng *r) {
+    if(mosqFreeCount == 0) return -1;
+    int i = mosqFreeSlots[--mosqFreeCount];
+
+    mosquitoes.generation[i]++;
+    mosquitoes.state[i]      = MSTATE_S;
+    mosquitoes.exposedDay[i] = -1;
+    mosquitoes.age[i]        = rngBelow(r, 30) + 1;
+
+    int bID = rngBelow(r, params.numBreedingSites);
+    moveMosquito(i, 2, bID);
+    mosqAlive++;
+    return i;
+}
+
+/* Mosquito swarms. With --mosquito-model counts there are no mosquito
+   records: each node holds its mosquitoes as counts in compartments, the
+   susceptible and infectious ones in mosqStates and the exposed ones split by
+   the day they were exposed in swarmCohorts. Every hourly and daily flow
+   (moves, feeding, deaths, the end of incubation) takes a binomial draw per
+   compartment instead of one per insect, so memory and time scale with nodes
+   and flows, not with the number of mosquitoes. */
+#define SWARM_S           0
+#define SWARM_I           1
+#define SWARM_E           2     /* Exposure cohort c is compartment SWARM_E + c */
+
+int swarmCompartments() {
+    return SWARM_E + cohortDays;
+}
+
+int* swarmCohort(int n, int cohort) {
+    return &swarmCohorts[(long)n * cohortDays + cohort];
+}
 
-    h->currentNet  = newNet;
-    h->currentNode = newNode;
+int swarmCount(int n, int comp) {
+    if(comp == SWARM_S) return nodes[n].mosqStates[MSTATE_S];
+    if(comp == SWARM_I) return nodes[n].mosqStates[MSTATE_I];
+    return *swarmCohort(n, comp - SWARM_E);
 }
 
-void moveMosquito(Mosquito *m, int newNet, int newNode) {
-    if(m->currentNet >= 0 && m->currentNode >= 0) {
-        Node* oldNode = getNode(m->currentNet, m->currentNode);
-        removeAgent(oldNode, m->id);
+/* Add delta mosquitoes to one compartment of node n, keeping mosqStates in step */
+void addSwarm(int n, int comp, int delta) {
+    if(comp == SWARM_S) nodes[n].mosqStates[MSTATE_S] += delta;
+    else if(comp == SWARM_I) nodes[n].mosqStates[MSTATE_I] += delta;
+    else {
+        *swarmCohort(n, comp - SWARM_E) += delta;
+        nodes[n].mosqStates[MSTATE_E]   += delta;
     }
-    addAgent(getNode(newNet, newNode), m->id);
+}
 
-    m->currentNet  = newNet;
-    m->currentNode = newNode;
+int swarmTotal(int n) {
+    return nodes[n].mosqStates[MSTATE_S] + nodes[n].mosqStates[MSTATE_E] + nodes[n].mosqStates[MSTATE_I];
 }
 
 /* Calculate distance between two nodes */
@@ -173,492 +852,2452 @@ double calculateDistance(Node *node1, Node *node2) {
 }
 
 /* Calculate movement probability based on distance */
-double movementProbability(Node *from, Node *to) {
-    double distance = calculateDistance(from, to);
-    return exp(-DISTANCE_FACTOR * distance);
-}
-
-/* Select destination based on distance-weighted probability */
-int selectDestination(int netID, int currentNodeID) {
-    Node *currentNode = getNode(netID, currentNodeID);
-    double totalWeight = 0.0;
-    double weights[100]; /* Max of houses, workplaces, or breeding sites */
-    int maxNodes;
-    
+double movementProbability(double distance) {
+    return exp(-params.distanceFactor * distance);
+}
+
+int networkSize(int netID) {
     switch(netID) {
-        case 0: maxNodes = NUM_HOUSES; break;
-        case 1: maxNodes = NUM_WORKPLACES; break;
-        case 2: maxNodes = NUM_BREEDINGSITES; break;
+        case 0: return params.numHouses;
+        case 1: return params.numWorkplaces;
+        case 2: return params.numBreedingSites;
         default: return 0;
     }
-    
-    /* Calculate weights for all possible destinations */
-    for(int i = 0; i < maxNodes; i++) {
-        Node *destNode = getNode(netID, i);
-        
-        /* Skip ITN-protected houses when calculating weights */
-        if(netID == 0 && destNode->has_ITN) {
-            weights[i] = 0.0; /* Zero weight for protected houses - mosquitoes cannot enter */
-        } else {
-            weights[i] = movementProbability(currentNode, destNode);
-        }
-        
-        totalWeight += weights[i];
+}
+
+/* Destination sampling. Moves from a node into a network pick each
+   destination with probability proportional to exp(-distanceFactor * d),
+   netted houses excluded. Those weights only change with the ITN layout, so
+   every (origin node, network) pair gets a Walker alias table up front and a
+   move costs one draw instead of a pass over the whole network.
+
+   With --dispersal-cutoff R the kernel is truncated to destinations within
+   distance R, found through a uniform grid, and --dispersal-max-dest K keeps
+   only the K nearest of those. Table size, and build time with a cutoff,
+   then scale with nodes x neighbours instead of nodes squared. */
+DestTable destTables[NUM_NETWORKS];
+
+/* Fill table (n entries) from weights, Vose's method. If every weight is
+   zero the table sends every draw to -1, meaning stay put. */
+void buildAliasTable(AliasEntry *table, double *weights, int n, int *small, int *large) {
+    double total = 0.0;
+    int numSmall = 0, numLarge = 0;
+
+    for(int k=0; k<n; k++) total += weights[k];
+    if(total <= 0.0) {
+        for(int k=0; k<n; k++) table[k] = (AliasEntry){ 0.0f, -1 };
+        return;
     }
-    
-    /* If all destinations have zero weight, return current node */
-    if(totalWeight <= 0.0) {
-        return currentNodeID;
+
+    for(int k=0; k<n; k++){
+        weights[k] *= n / total;
+        if(weights[k] < 1.0) small[numSmall++] = k;
+        else large[numLarge++] = k;
     }
-    
-    /* Normalize weights and select destination */
-    double r = randDouble() * totalWeight;
-    double cumulativeWeight = 0.0;
-    
-    for(int i = 0; i < maxNodes; i++) {
-        cumulativeWeight += weights[i];
-        if(r <= cumulativeWeight) {
-            return i;
-        }
+    while(numSmall > 0 && numLarge > 0) {
+        int s = small[--numSmall], l = large[--numLarge];
+        table[s] = (AliasEntry){ (float)weights[s], l };
+        weights[l] -= 1.0 - weights[s];
+        if(weights[l] < 1.0) small[numSmall++] = l;
+        else large[numLarge++] = l;
     }
-    
-    return currentNodeID; /* Default to current node if something goes wrong */
+    /* Leftovers are 1 up to rounding */
+    while(numLarge > 0) { int l = large[--numLarge]; table[l] = (AliasEntry){ 1.0f, l }; }
+    while(numSmall > 0) { int s = small[--numSmall]; table[s] = (AliasEntry){ 1.0f, s }; }
 }
 
-/* ----------------- Initialization ----------------- */
+/* Uniform grid over the nodes of one network, with cells no smaller than
+   the cutoff so every neighbour of a point lies in the 3x3 cells around it */
+typedef struct {
+    int     dim;       /* Cells per side */
+    double  cellSize;
+    int    *start;     /* [dim * dim + 1], nodes of cell c are ids[start[c] .. start[c+1]) */
+    int    *ids;       /* Node indices within the network */
+} NodeGrid;
 
-void initNetworks() {
-    for(int i=0; i<NUM_HOUSES; i++){ 
-        houses[i].occupantCount = 0; 
-        /* Assign random coordinates */
-        houses[i].x = randDouble() * GRID_SIZE;
-        houses[i].y = randDouble() * GRID_SIZE;
-        
-        /* NEW: Assign ITN protection to houses based on coverage */
-        houses[i].has_ITN = (randDouble() < ITN_COVERAGE) ? 1 : 0;
-    }
-    
-    for(int i=0; i<NUM_WORKPLACES; i++){ 
-        workplaces[i].occupantCount = 0; 
-        /* Assign random coordinates */
-        workplaces[i].x = randDouble() * GRID_SIZE;
-        workplaces[i].y = randDouble() * GRID_SIZE;
-    }
-    
-    for(int i=0; i<NUM_BREEDINGSITES; i++){ 
-        breedingSites[i].occupantCount = 0; 
-        /* Assign random coordinates */
-        breedingSites[i].x = randDouble() * GRID_SIZE;
-        breedingSites[i].y = randDouble() * GRID_SIZE;
+#define GRID_MAX_DIM      1024
+
+int gridCell(const NodeGrid *grid, double v) {
+    int c = (int)(v / grid->cellSize);
+    return c < 0 ? 0 : c >= grid->dim ? grid->dim - 1 : c;
+}
+
+void buildNodeGrid(NodeGrid *grid, int netID, double cutoff) {
+    int n = networkSize(netID);
+    /* Clamp before converting: a tiny cutoff would overflow an int */
+    grid->dim = (int)fmin(fmax(params.gridSize / cutoff, 1.0), GRID_MAX_DIM);
+    grid->cellSize = params.gridSize / grid->dim;
+
+    int cells = grid->dim * grid->dim;
+    int *cellOf = allocOrDie(n, sizeof(int));
+    grid->start = allocOrDie(cells + 1, sizeof(int));
+    grid->ids   = allocOrDie(n, sizeof(int));
+    for(int k=0; k<n; k++){
+        Node *node = getNode(netID, k);
+        cellOf[k] = gridCell(grid, node->y) * grid->dim + gridCell(grid, node->x);
+        grid->start[cellOf[k] + 1]++;
     }
+    for(int c=0; c<cells; c++) grid->start[c + 1] += grid->start[c];
+    int *fill = allocOrDie(cells, sizeof(int));
+    memcpy(fill, grid->start, sizeof(int) * cells);
+    for(int k=0; k<n; k++) grid->ids[fill[cellOf[k]]++] = k;
+    free(fill);
+    free(cellOf);
 }
 
-void initPopulations() {
-    /* Humans */
-    for(int i=0; i<NUM_HUMANS; i++){
-        humans[i].id           = i;
-        humans[i].state        = STATE_S;
-        humans[i].infectedDay  = -1;
-        humans[i].age          = rand()%46 + 15;
-        
-        humans[i].homeNet  = 0; /* Houses */
-        humans[i].homeNode = rand() % NUM_HOUSES;
-        humans[i].workNet  = 1; /* Workplaces */
-        humans[i].workNode = rand() % NUM_WORKPLACES;
+void freeNodeGrid(NodeGrid *grid) {
+    free(grid->start);
+    free(grid->ids);
+}
 
-        humans[i].currentNet   = -1;
-        humans[i].currentNode  = -1;
-        
-        /* NEW: Assign treatment status based on coverage */
-        humans[i].under_treatment = (randDouble() < TREATMENT_RATE) ? 1 : 0;
-        humans[i].treatment_day = -1;
-        
-        moveHuman(&humans[i], humans[i].homeNet, humans[i].homeNode);
+typedef struct {
+    double distance;
+    int    id;
+} Candidate;
+
+int compareCandidates(const void *a, const void *b) {
+    const Candidate *x = a, *y = b;
+    if(x->distance != y->distance) return x->distance < y->distance ? -1 : 1;
+    return x->id - y->id;
+}
 
-        if(i < 10) {
-            humans[i].state       = STATE_I;
-            humans[i].infectedDay = 0;
+/* Destinations in network netID reachable from origin, into out[]; returns
+   how many. Without a cutoff that is the whole network. */
+int findCandidates(const Node *origin, int netID, const NodeGrid *grid, Candidate *out) {
+    double cutoff = params.dispersalCutoff;
+    int count = 0;
+
+    if(cutoff <= 0.0) {
+        for(int k=0; k<networkSize(netID); k++){
+            out[count++] = (Candidate){ calculateDistance((Node*)origin, getNode(netID, k)), k };
+        }
+    } else {
+        int cx = gridCell(grid, origin->x), cy = gridCell(grid, origin->y);
+        for(int y = cy > 0 ? cy - 1 : 0; y <= cy + 1 && y < grid->dim; y++){
+            for(int x = cx > 0 ? cx - 1 : 0; x <= cx + 1 && x < grid->dim; x++){
+                int c = y * grid->dim + x;
+                for(int j=grid->start[c]; j<grid->start[c + 1]; j++){
+                    int k = grid->ids[j];
+                    double d = calculateDistance((Node*)origin, getNode(netID, k));
+                    if(d <= cutoff) out[count++] = (Candidate){ d, k };
+                }
+            }
         }
+        /* Grid order is not node order; sort so the tables do not depend on it */
+        qsort(out, count, sizeof(Candidate), compareCandidates);
     }
 
-    /* Mosquitoes */
-    for(int i=0; i<NUM_MOSQUITOES; i++){
-        mosquitoes[i].id         = 10000 + i;
-        mosquitoes[i].state      = MSTATE_S;
-        mosquitoes[i].exposedDay = -1;
-        mosquitoes[i].age        = rand()%30 + 1;
-
-        mosquitoes[i].breedNet  = 2; /* breedingSites */
-        mosquitoes[i].breedNode = rand() % NUM_BREEDINGSITES;
-
-        mosquitoes[i].currentNet  = -1;
-        mosquitoes[i].currentNode = -1;
-        moveMosquito(&mosquitoes[i], mosquitoes[i].breedNet, mosquitoes[i].breedNode);
+    if(params.dispersalMaxDest > 0 && count > params.dispersalMaxDest) {
+        if(cutoff <= 0.0) qsort(out, count, sizeof(Candidate), compareCandidates);
+        count = params.dispersalMaxDest;
+    }
+    return count;
+}
 
-        if(i < 100) {
-            mosquitoes[i].state = MSTATE_I;
+/* (Re)build the tables of every origin for moves into network netID. Must be
+   called again for network 0 whenever a house's has_ITN changes. */
+void buildDestinationTables(int netID) {
+    int n = networkSize(netID);
+    Candidate *candidates = allocOrDie(n, sizeof(Candidate));
+    double *weights = allocOrDie(n, sizeof(double));
+    int *small = allocOrDie(n, sizeof(int));
+    int *large = allocOrDie(n, sizeof(int));
+    NodeGrid grid = { 0 };
+    DestTable dest = { allocOrDie(numNodes + 1, sizeof(long)), NULL, NULL, NULL };
+    int shares = params.mosquitoModel == MOSQ_COUNTS;
+    long capacity = 0;
+
+    if(params.dispersalCutoff > 0.0) buildNodeGrid(&grid, netID, params.dispersalCutoff);
+
+    for(int o=0; o<numNodes; o++){
+        int count = findCandidates(&nodes[o], netID, &grid, candidates);
+        long first = dest.start[o];
+        dest.start[o + 1] = first + count;
+
+        if(first + count > capacity) {
+            capacity = (first + count) * 2;
+            dest.ids   = reallocOrDie(dest.ids, capacity, sizeof(int));
+            dest.table = reallocOrDie(dest.table, capacity, sizeof(AliasEntry));
+            if(shares) dest.share = reallocOrDie(dest.share, capacity, sizeof(float));
+        }
+        for(int j=0; j<count; j++){
+            Node *destNode = getNode(netID, candidates[j].id);
+            dest.ids[first + j] = candidates[j].id;
+            /* Zero weight for protected houses - mosquitoes cannot enter */
+            weights[j] = (netID == 0 && destNode->has_ITN) ? 0.0 : movementProbability(candidates[j].distance);
         }
+        if(shares) {
+            double total = 0.0;
+            for(int j=0; j<count; j++) total += weights[j];
+            for(int j=0; j<count; j++) dest.share[first + j] = total > 0.0 ? (float)(weights[j] / total) : 0.0f;
+        }
+        buildAliasTable(&dest.table[first], weights, count, small, large);
     }
+
+    free(destTables[netID].start);
+    free(destTables[netID].ids);
+    free(destTables[netID].table);
+    free(destTables[netID].share);
+    destTables[netID] = dest;
+
+    if(params.dispersalCutoff > 0.0) freeNodeGrid(&grid);
+    free(candidates);
+    free(weights);
+    free(small);
+    free(large);
 }
 
-/* ----------------- Simulation Steps ----------------- */
+/* Select destination based on distance-weighted probability from the node the
+   mosquito currently occupies (which may be in another network).
+   Returns -1 when no destination can be reached. */
+int selectDestination(Rng *r, int netID, Node *currentNode) {
+    const DestTable *dest = &destTables[netID];
+    int o = (int)(currentNode - nodes);
+    long first = dest->start[o];
+    int n = (int)(dest->start[o + 1] - first);
+    if(n == 0) return -1;
+
+    double u = rngDouble(r) * n;
+    int k = (int)u;
+    if(k == n) k = n - 1; /* u can round up to n */
+    int pick = (u - k) < dest->table[first + k].prob ? k : dest->table[first + k].alias;
+    return pick < 0 ? -1 : dest->ids[first + pick];
+}
 
-void scheduleMovement() {
-    int currentHour = hour % 24;
+/* ----------------- Disease Calendar ----------------- */
 
-    /* Humans: move between home and work */
-    for(int i=0; i<NUM_HUMANS; i++){
-        Human *h = &humans[i];
-        if(h->id < 0) continue; /* Dead human. */
+/* Transitions whose time is known in advance are scheduled when the agent
+   enters the state instead of being polled every day: E -> I fires tauM days
+   after exposure, and I -> R, which is a daily Bernoulli trial from day 14,
+   has its day drawn up front as 14 + Geometric(p) days after infection. */
 
-        if(currentHour >= 8 && currentHour < 18) {
-            if(!(h->currentNet == h->workNet && h->currentNode == h->workNode)) {
-                moveHuman(h, h->workNet, h->workNode);
-            }
-        } else {
-            if(!(h->currentNet == h->homeNet && h->currentNode == h->homeNode)) {
-                moveHuman(h, h->homeNet, h->homeNode);
-            }
-        }
+EventList dueEvents; /* Scratch for runDueTransitions() */
+
+void pushEvent(EventList *list, Event ev) {
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = reallocOrDie(list->items, list->capacity, sizeof(Event));
     }
+    list->items[list->count++] = ev;
+}
 
-    /* Remove mosquitoes from houses with bed nets */
-    for(int i=0; i<NUM_MOSQUITOES; i++){
-        Mosquito *m = &mosquitoes[i];
-        if(m->id < 0) continue; /* Dead mosquito */
-        
-        /* If mosquito is in a house with bed nets, move it to a breeding site */
-        if(m->currentNet == 0) { /* House network */
-            Node* house = getNode(m->currentNet, m->currentNode);
-            if(house->has_ITN) {
-                /* Move to a random breeding site */
-                int bID = rand() % NUM_BREEDINGSITES;
-                moveMosquito(m, 2, bID);
-                continue; /* Skip the normal movement logic */
-            }
-        }
+void scheduleEvent(EventList *ring, int agent, long dueDay, uint32_t generation) {
+    if(dueDay >= params.days) return; /* After the end of the run */
+    pushEvent(&ring[dueDay % CALENDAR_DAYS], (Event){ agent, (int32_t)dueDay, generation });
+}
 
-        /* Normal mosquito movement logic */
-        if(randDouble() < MOSQ_MOVE_CHANCE) {
-            int newNet, newNode;
-            if(currentHour > 18 || currentHour < 6) {
-                /* House or workplace at night */
-                if(randDouble() < 0.5){
-                    newNet = 0;
-                    /* Use spatial selection for destination - ITN protection handled in selectDestination */
-                    newNode = selectDestination(newNet, m->currentNode);
-                } else {
-                    newNet = 1;
-                    newNode = selectDestination(newNet, m->currentNode);
-                }
-            } else {
-                /* Breeding site in daytime */
-                newNet = 2;
-                newNode = selectDestination(newNet, m->currentNode);
-            }
-            
-            /* Only move if the destination is different from current location */
-            if(newNet != m->currentNet || newNode != m->currentNode) {
-                moveMosquito(m, newNet, newNode);
-            }
-        }
+/* Draw the day infected human H recovers on. Treatment is decided at
+   infection, so the daily recovery probability is already fixed. */
+void scheduleRecovery(Calendar *cal, Rng *r, int H) {
+    double logQ = (humans.flags[H] & HUMAN_TREATED) ? treatedRecoveryLogQ : recoveryLogQ;
+    if(logQ == 0.0) return; /* Never recovers */
+    double wait = log(rngOpenDouble(r)) / logQ;
+    if(wait >= params.days) return;
+    scheduleEvent(cal->recoveries, H, humans.infectedDay[H] + RECOVERY_DELAY_DAYS + (long)wait, 0);
+}
+
+void scheduleIncubation(Calendar *cal, int i) {
+    scheduleEvent(cal->incubations, i, mosquitoes.exposedDay[i] + params.tauM, mosquitoes.generation[i]);
+}
+
+void fireRecovery(const Event *ev) {
+    if(humans.state[ev->agent] == STATE_I) setHumanState(ev->agent, STATE_R, 0);
+}
+
+void fireIncubation(const Event *ev) {
+    if(mosquitoes.generation[ev->agent] == ev->generation && mosquitoes.state[ev->agent] == MSTATE_E) {
+        setMosquitoState(ev->agent, MSTATE_I);
     }
 }
 
-void handleInfections() {
-    /* Gather humans by location for quick lookup. We'll reuse static arrays each hour. */
-    static int humansAtHouse[NUM_HOUSES][MAX_OCCUPANTS];
-    static int countHouse[NUM_HOUSES];
-    for(int i=0; i<NUM_HOUSES; i++){ countHouse[i] = 0; }
-
-    static int humansAtWP[NUM_WORKPLACES][MAX_OCCUPANTS];
-    static int countWP[NUM_WORKPLACES];
-    for(int i=0; i<NUM_WORKPLACES; i++){ countWP[i] = 0; }
-
-    static int humansAtBS[NUM_BREEDINGSITES][MAX_OCCUPANTS];
-    static int countBS[NUM_BREEDINGSITES];
-    for(int i=0; i<NUM_BREEDINGSITES; i++){ countBS[i] = 0; }
-
-    /* Place humans in relevant array */
-    for(int i=0; i<NUM_HUMANS; i++){
-        if(humans[i].id < 0) continue; /* Dead */
-        int netID  = humans[i].currentNet;
-        int nodeID = humans[i].currentNode;
-        if(netID == 0){
-            int idx = countHouse[nodeID]++;
-            humansAtHouse[nodeID][idx] = i;
-        } else if(netID == 1){
-            int idx = countWP[nodeID]++;
-            humansAtWP[nodeID][idx] = i;
-        } else if(netID == 2){
-            int idx = countBS[nodeID]++;
-            humansAtBS[nodeID][idx] = i;
-        }
-    }
-
-    /* Check mosquitoes */
-    for(int i=0; i<NUM_MOSQUITOES; i++){
-        Mosquito *m = &mosquitoes[i];
-        if(m->id < 0) continue;
-
-        int netID  = m->currentNet;
-        int nodeID = m->currentNode;
-
-        int localCount = 0;
-        int *localHumans;
-
-        if(netID == 0){
-            localCount   = countHouse[nodeID];
-            localHumans  = humansAtHouse[nodeID];
-        } else if(netID == 1){
-            localCount   = countWP[nodeID];
-            localHumans  = humansAtWP[nodeID];
-        } else if(netID == 2){
-            localCount   = countBS[nodeID];
-            localHumans  = humansAtBS[nodeID];
-        }
-        if(localCount <= 0) continue;
-
-        if(m->state == MSTATE_I){
-            /* Infect humans with prob HOURLY_BITING_PROB, then B_MOS_TO_HUMAN */
-            if(randDouble() < HOURLY_BITING_PROB){
-                for(int h=0; h<localCount; h++){
-                    Human *H = &humans[localHumans[h]];
-                    if(H->state == STATE_S && H->id >= 0){
-                        /* Apply ITN protection if human has one */
-                        double effectiveBiteProb = 1.0;
-                        if(H->has_ITN) {
-                            effectiveBiteProb *= (1.0 - ITN_EFFICACY);
-                            
-                            /* Mosquito mortality from ITN contact */
-                            if(randDouble() < ITN_KILL_PROB) {
-                                Node *node = getNode(m->currentNet, m->currentNode);
-                                removeAgent(node, m->id);
-                                m->id = -1;
-                                break; /* Mosquito is dead, exit loop */
-                            }
-                        }
-                        
-                        if(randDouble() < B_MOS_TO_HUMAN * effectiveBiteProb){
-                            H->state = STATE_I;
-                            H->infectedDay = day;
-                            
-                            /* Determine if human gets treatment */
-                            if(randDouble() < TREATMENT_RATE) {
-                                H->under_treatment = 1;
-                                H->treatment_day = day;
-                            }
-                        }
-                    }
-                }
-            }
-        } else if(m->state == MSTATE_S){
-            /* Maybe get infected from local infected humans */
-            int infectedHere = 0;
-            for(int h=0; h<localCount; h++){
-                Human *H = &humans[localHumans[h]];
-                if(H->state == STATE_I) {
-                    /* Reduced transmission from treated humans */
-                    double transmissionFactor = 1.0;
-                    if(H->under_treatment) {
-                        transmissionFactor *= (1.0 - TREATMENT_EFFECT);
-                    }
-                    infectedHere += transmissionFactor;
-                }
-            }
-            if(infectedHere > 0){
-                if(randDouble() < HOURLY_BITING_PROB){
-                    if(randDouble() < C_HUMAN_TO_MOS){
-                        m->state = MSTATE_E;
-                        m->exposedDay = day;
-                    }
-                }
-            }
-        }
+/* Move the events due today from one bucket to dueEvents, keeping those
+   due on a later lap */
+void takeDue(EventList *list) {
+    int kept = 0;
+    for(int k=0; k<list->count; k++){
+        if(list->items[k].day == day) pushEvent(&dueEvents, list->items[k]);
+        else list->items[kept++] = list->items[k];
     }
+    list->count = kept;
 }
 
-void updateStates() {
-    /* Humans */
-    for(int i=0; i<NUM_HUMANS; i++){
-        Human *h = &humans[i];
-        if(h->id < 0) continue; /* Already dead */
-
-        if(h->state == STATE_I){
-            double recoveryProb = HUMAN_RECOVERY;
-            
-            /* Increase recovery rate for treated humans */
-            if(h->under_treatment) {
-                recoveryProb *= 3.0; /* Triple the recovery rate instead of doubling it */
-            }
-            
-            if((day - h->infectedDay) >= 14){
-                if(randDouble() < recoveryProb){
-                    h->state = STATE_R;
-                }
-            }
-        }
+int compareEventAgents(const void *a, const void *b) {
+    int x = ((const Event*)a)->agent, y = ((const Event*)b)->agent;
+    return (x > y) - (x < y);
+}
 
-        /* Mortality */
-        if(randDouble() < HUMAN_MORTALITY){
-            Node *node = getNode(h->currentNet, h->currentNode);
-            removeAgent(node, h->id);
-            h->id = -1; /* mark dead */
-        }
-    }
+/* Fire what takeDue() collected. Which calendar holds an event depends on
+   the thread split, and an incubation re-files its mosquito within the
+   node's list, so events fire in agent order to keep runs independent of
+   the thread count. */
+void fireCollected(void (*fire)(const Event *ev)) {
+    if(dueEvents.count == 0) return;   /* items may still be NULL */
+    qsort(dueEvents.items, dueEvents.count, sizeof(Event), compareEventAgents);
+    for(int k=0; k<dueEvents.count; k++) fire(&dueEvents.items[k]);
+    dueEvents.count = 0;
+}
 
-    /* Mosquitoes */
-    for(int i=0; i<NUM_MOSQUITOES; i++){
-        Mosquito *m = &mosquitoes[i];
-        if(m->id < 0) continue;
+/* Serial; firing draws nothing */
+void runDueTransitions() {
+    int bucket = day % CALENDAR_DAYS;
 
-        if(m->state == MSTATE_E){
-            if((day - m->exposedDay) >= TAU_M){
-                m->state = MSTATE_I;
-            }
-        }
+    for(int t=0; t<params.threads; t++) takeDue(&calendars[t].recoveries[bucket]);
+    fireCollected(fireRecovery);
+    for(int t=0; t<params.threads; t++) takeDue(&calendars[t].incubations[bucket]);
+    fireCollected(fireIncubation);
+}
 
-        /* Mosquito mortality */
-        if(randDouble() < MOSQ_MORTALITY){
-            Node *node = getNode(m->currentNet, m->currentNode);
-            removeAgent(node, m->id);
-            m->id = -1;
-        }
+/* ----------------- Human Schedules ----------------- */
+
+/* Whether human i's schedule puts them at work in the given hour of the week */
+int humanAtWork(int i, int hourOfWeek) {
+    int d = hourOfWeek / HOURS_PER_DAY, h = hourOfWeek % HOURS_PER_DAY;
+    int start = humans.workStart[i], end = humans.workEnd[i];
+    int today = (humans.workDays[i] >> d) & 1;
+
+    if(start < end) return today && h >= start && h < end;
+
+    /* Overnight shift: either started this evening or started yesterday */
+    int yesterday = (humans.workDays[i] >> ((d + DAYS_PER_WEEK - 1) % DAYS_PER_WEEK)) & 1;
+    return (today && h >= start) || (yesterday && h < end);
+}
+
+/* Where human i's schedule puts them in the given hour of the week, into
+   (*net, *node). Returns whether that is somewhere else than where they are. */
+int humanTarget(int i, int hourOfWeek, int *net, int *node) {
+    int atWork = humanAtWork(i, hourOfWeek);
+    *net  = atWork ? humans.workNet[i]  : humans.homeNet[i];
+    *node = atWork ? humans.workNode[i] : humans.homeNode[i];
+    return !(humans.net[i] == *net && humans.node[i] == (uint32_t)*node);
+}
+
+/* Hours of the week at which human i departs: the start and end of each
+   shift. Returns how many were written to slots (at most 2 per day). */
+int departureHours(int i, int *slots) {
+    int n = 0;
+    for(int d=0; d<DAYS_PER_WEEK; d++){
+        if(!((humans.workDays[i] >> d) & 1)) continue;
+        int start = d * HOURS_PER_DAY + humans.workStart[i];
+        int end   = d * HOURS_PER_DAY + humans.workEnd[i];
+        if(humans.workEnd[i] <= humans.workStart[i]) end += HOURS_PER_DAY;
+        slots[n++] = start;
+        slots[n++] = end % HOURS_PER_WEEK;
     }
+    return n;
+}
 
-    /* Repopulate mosquitoes if below 5000 alive */
-    int aliveCount = 0;
-    for(int i=0; i<NUM_MOSQUITOES; i++){
-        if(mosquitoes[i].id >= 0) aliveCount++;
+/* Schedules repeat every week, so the wheel is built once; dead humans are
+   skipped when their slot comes up and dropped by compactScheduleWheel() */
+void buildScheduleWheel() {
+    int slots[2 * DAYS_PER_WEEK];
+    int *fill;
+
+    wheelStart = allocOrDie(HOURS_PER_WEEK + 1, sizeof(int));
+    for(int i=0; i<humanCount; i++){
+        if(humans.state[i] == STATE_DEAD) continue;
+        int n = departureHours(i, slots);
+        for(int k=0; k<n; k++) wheelStart[slots[k] + 1]++;
     }
-    int needed = 5000 - aliveCount;
-    for(int i=0; i<needed; i++){
-        for(int j=0; j<NUM_MOSQUITOES; j++){
-            if(mosquitoes[j].id < 0){
-                /* Respawn here */
-                int newID = 10000 + j;
-                mosquitoes[j].id = newID;
-                mosquitoes[j].state = MSTATE_S;
-                mosquitoes[j].exposedDay = -1;
-                mosquitoes[j].age = rand()%30 + 1;
+    for(int s=0; s<HOURS_PER_WEEK; s++) wheelStart[s + 1] += wheelStart[s];
+
+    wheelHumans = allocOrDie(wheelStart[HOURS_PER_WEEK], sizeof(int));
+    fill        = allocOrDie(HOURS_PER_WEEK, sizeof(int));
+    memcpy(fill, wheelStart, sizeof(int) * HOURS_PER_WEEK);
+    for(int i=0; i<humanCount; i++){
+        if(humans.state[i] == STATE_DEAD) continue;
+        int n = departureHours(i, slots);
+        for(int k=0; k<n; k++) wheelHumans[fill[slots[k]]++] = i;
+    }
+    free(fill);
+}
 
-                int bID = rand() % NUM_BREEDINGSITES;
-                moveMosquito(&mosquitoes[j], 2, bID);
-                break;
-            }
-        }
+/* Add a human created after the wheel was built */
+void addPendingHuman(int i) {
+    if(numWheelPending == wheelPendingCapacity) {
+        wheelPendingCapacity = wheelPendingCapacity ? wheelPendingCapacity * 2 : 64;
+        wheelPending = reallocOrDie(wheelPending, wheelPendingCapacity, sizeof(int));
     }
+    wheelPending[numWheelPending++] = i;
+
+    int slots[2 * DAYS_PER_WEEK];
+    int n = departureHours(i, slots);
+    for(int k=0; k<n; k++) pendingDepartures[slots[k]]++;
 }
 
-/* Record daily stats in arrays for later CSV output */
-void recordStats() {
-    int S=0, I=0, R=0;
-    int E_m=0, I_m=0;
-    int itn_count=0, treat_count=0;
-
-    for(int i=0; i<NUM_HUMANS; i++){
-        if(humans[i].id < 0) continue;
-        switch(humans[i].state){
-            case STATE_S: S++; break;
-            case STATE_I: I++; break;
-            case STATE_R: R++; break;
-        }
-        
-        /* Count interventions */
-        if(humans[i].has_ITN) itn_count++;
-        if(humans[i].under_treatment) treat_count++;
-    }
-    int totalH = S + I + R;
-
-    for(int i=0; i<NUM_MOSQUITOES; i++){
-        if(mosquitoes[i].id < 0) continue;
-        if(mosquitoes[i].state == MSTATE_E) E_m++;
-        else if(mosquitoes[i].state == MSTATE_I) I_m++;
-    }
-
-    S_history[day] = S;
-    I_history[day] = I;
-    R_history[day] = R;
-    E_history[day] = E_m;
-    IM_history[day] = I_m;
-    total_history[day] = totalH;
-    
-    /* Record intervention stats */
-    itn_protected[day] = itn_count;
-    treatment_count[day] = treat_count;
+/* Drop dead humans from the wheel, keeping each slot in index order. If
+   humans were split off since the last build, rebuild it to take them in. */
+void compactScheduleWheel() {
+    if(numWheelPending > 0) {
+        free(wheelStart);
+        free(wheelHumans);
+        buildScheduleWheel();
+        numWheelPending = 0;
+        memset(pendingDepartures, 0, sizeof(pendingDepartures));
+        return;
+    }
 
-    /* House-level: count infected per house */
-    for(int h=0; h<NUM_HOUSES; h++){
-        int infectedCount = 0;
-        for(int occ=0; occ<houses[h].occupantCount; occ++){
-            int agID = houses[h].occupantIDs[occ];
-            if(agID >= 0 && agID < NUM_HUMANS){  /* is a human */
-                if(humans[agID].id >= 0 && humans[agID].state == STATE_I) {
-                    infectedCount++;
-                }
-            }
+    int out = 0;
+    for(int s=0; s<HOURS_PER_WEEK; s++){
+        int begin = wheelStart[s];
+        wheelStart[s] = out;
+        for(int k=begin; k<wheelStart[s + 1]; k++){
+            if(humans.state[wheelHumans[k]] != STATE_DEAD) wheelHumans[out++] = wheelHumans[k];
         }
-        house_infected_series[day][h] = infectedCount;
     }
+    wheelStart[HOURS_PER_WEEK] = out;
 }
 
-int main(){
-    srand((unsigned) time(0));
-
-    initNetworks();
-    initPopulations();
+/* ----------------- Parameters ----------------- */
 
-    /* Run simulation */
-    for(day=0; day<DAYS; day++){
-        for(int h=0; h<HOURS_PER_DAY; h++){
-            scheduleMovement();
-            handleInfections();
-            hour++;
-        }
-        updateStates();
-        recordStats();
+ParamSpec* findParam(const char *name) {
+    for(int i=0; i<NUM_PARAM_SPECS; i++){
+        if(strcmp(paramSpecs[i].name, name) == 0) return &paramSpecs[i];
     }
+    return NULL;
+}
 
-    /* ----------------- Write CSV Files ----------------- */
-
-    /* 1) Global stats to global_stats.csv */
-    FILE *fglobal = fopen("global_stats.csv", "w");
-    if(fglobal){
-        fprintf(fglobal, "day,S,I,R,E_mos,I_mos,totalHumans,itn_protected,treated_humans\n");
-        for(int d=0; d<DAYS; d++){
-            fprintf(fglobal, "%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
-                d,
-                S_history[d],
-                I_history[d],
-                R_history[d],
-                E_history[d],
-                IM_history[d],
-                total_history[d],
-                itn_protected[d],
-                treatment_count[d]);
-        }
-        fclose(fglobal);
-        printf("global_stats.csv written!\n");
-    } else {
-        printf("Could not open global_stats.csv for writing.\n");
-    }
-
-    /* 2) House-level infected stats to house_infected.csv */
-    FILE *fhouses = fopen("house_infected.csv", "w");
-    if(fhouses){
-        fprintf(fhouses, "day,houseID,infectedHumans,x,y,has_ITN\n");
-        for(int d=0; d<DAYS; d++){
-            for(int h=0; h<NUM_HOUSES; h++){
-                fprintf(fhouses, "%d,%d,%d,%.2f,%.2f,%d\n",
-                    d, h, house_infected_series[d][h], 
-                    houses[h].x, houses[h].y, houses[h].has_ITN);
+int setParam(const char *name, const char *value) {
+    ParamSpec *spec = findParam(name);
+    char *end;
+    if(!spec) {
+        fprintf(stderr, "Unknown parameter '%s'\n", name);
+        return 0;
+    }
+    if(spec->type == PARAM_INT) {
+        errno = 0;
+        long v = strtol(value, &end, 10);
+        if(end == value || *end != '\0' || errno == ERANGE || v < INT_MIN || v > INT_MAX) {
+            fprintf(stderr, "Parameter '%s' expects an integer, got '%s'\n", name, value);
+            return 0;
+        }
+        *(int*)spec->value = (int)v;
+    } else if(spec->type == PARAM_U64) {
+        errno = 0;
+        unsigned long long v = strtoull(value, &end, 10);
+        if(end == value || *end != '\0' || value[0] == '-' || errno == ERANGE) {
+            fprintf(stderr, "Parameter '%s' expects a non-negative integer, got '%s'\n", name, value);
+            return 0;
+        }
+        *(uint64_t*)spec->value = v;
+    } else if(spec->type == PARAM_CHOICE) {
+        for(int c=0; spec->choices[c]; c++){
+            if(strcmp(spec->choices[c], value) == 0) {
+                *(int*)spec->value = c;
+                return 1;
             }
         }
-        fclose(fhouses);
-        printf("house_infected.csv written!\n");
+        fprintf(stderr, "Parameter '%s' does not accept '%s'\n", name, value);
+        return 0;
     } else {
-        printf("Could not open house_infected.csv for writing.\n");
+        double v = strtod(value, &end);
+        if(end == value || *end != '\0' || !isfinite(v)) {
+            fprintf(stderr, "Parameter '%s' expects a finite number, got '%s'\n", name, value);
+            return 0;
+        }
+        *(double*)spec->value = v;
+    }
+    return 1;
+}
+
+/* Parameter file: one "key = value" per line, '#' starts a comment */
+int loadParamFile(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[256];
+    int lineNo = 0;
+    if(!f) {
+        fprintf(stderr, "Could not open parameter file %s\n", path);
+        return 0;
+    }
+    while(fgets(line, sizeof(line), f)) {
+        char key[128], value[128];
+        lineNo++;
+        char *hash = strchr(line, '#');
+        if(hash) *hash = '\0';
+        for(char *c = line; *c; c++) if(*c == '=') *c = ' ';
+        int n = sscanf(line, "%127s %127s", key, value);
+        if(n <= 0) continue; /* Blank or comment-only line */
+        if(n != 2 || !setParam(key, value)) {
+            fprintf(stderr, "%s:%d: invalid parameter line\n", path, lineNo);
+            fclose(f);
+            return 0;
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+void printUsage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--params FILE] [--<name> VALUE]...\n", prog);
+    fprintf(stderr, "Parameters (defaults in brackets):\n");
+    for(int i=0; i<NUM_PARAM_SPECS; i++){
+        if(paramSpecs[i].type == PARAM_INT)
+            fprintf(stderr, "  --%-28s [%d]\n", paramSpecs[i].name, *(int*)paramSpecs[i].value);
+        else if(paramSpecs[i].type == PARAM_U64)
+            fprintf(stderr, "  --%-28s [%llu]\n", paramSpecs[i].name,
+                    (unsigned long long)*(uint64_t*)paramSpecs[i].value);
+        else if(paramSpecs[i].type == PARAM_CHOICE)
+            fprintf(stderr, "  --%-28s [%s]\n", paramSpecs[i].name,
+                    paramSpecs[i].choices[*(int*)paramSpecs[i].value]);
+        else
+            fprintf(stderr, "  --%-28s [%g]\n", paramSpecs[i].name, *(double*)paramSpecs[i].value);
     }
+}
+
+int parseArgs(int argc, char **argv) {
+    for(int i=1; i<argc; i++){
+        if(strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            printUsage(argv[0]);
+            exit(0);
+        }
+        if(strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) {
+            fprintf(stderr, "Unexpected argument '%s'\n", argv[i]);
+            return 0;
+        }
+        const char *name  = argv[i] + 2;
+        const char *value = argv[++i];
+        if(strcmp(name, "params") == 0) {
+            if(!loadParamFile(value)) return 0;
+        } else if(!setParam(name, value)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Parameters that are chances of an event and must lie in [0, 1] */
+const char *const probabilityParams[] = {
+    "biting-prob", "b-mos-to-human", "c-human-to-mos", "human-recovery",
+    "mosq-mortality", "human-mortality", "mosq-move-chance", "non-worker-frac",
+    "itn-coverage", "itn-efficacy", "itn-kill-prob", "treatment-rate",
+    "treatment-effect", NULL
+};
+
+int validateParams() {
+    for(int i=0; probabilityParams[i]; i++){
+        double p = *(double*)findParam(probabilityParams[i])->value;
+        if(!(p >= 0.0 && p <= 1.0)) {
+            fprintf(stderr, "%s must be between 0 and 1\n", probabilityParams[i]);
+            return 0;
+        }
+    }
+    if(params.numHouses <= 0 || params.numWorkplaces <= 0 || params.numBreedingSites <= 0) {
+        fprintf(stderr, "Every network needs at least one node\n");
+        return 0;
+    }
+    if(params.numHumans < 0 || params.numMosquitoes < 0 || params.days <= 0) {
+        fprintf(stderr, "Population sizes must be non-negative and days positive\n");
+        return 0;
+    }
+    if(params.workStart < 0 || params.workStart >= HOURS_PER_DAY ||
+       params.workEnd < 0 || params.workEnd >= HOURS_PER_DAY || params.workStart == params.workEnd) {
+        fprintf(stderr, "work-start and work-end must be distinct hours 0-23\n");
+        return 0;
+    }
+    if(params.shiftSpread < 0 || params.shiftSpread >= HOURS_PER_DAY ||
+       params.weekendDays < 0 || params.weekendDays > DAYS_PER_WEEK) {
+        fprintf(stderr, "shift-spread must be 0-23 hours and weekend-days 0-7\n");
+        return 0;
+    }
+    if(params.gridSize <= 0 || params.dispersalCutoff < 0 || params.dispersalMaxDest < 0) {
+        fprintf(stderr, "grid-size must be positive, dispersal-cutoff and dispersal-max-dest non-negative\n");
+        return 0;
+    }
+    if(params.humanWeight < 1 || params.splitWeight < 1) {
+        fprintf(stderr, "human-weight and split-weight must be at least 1\n");
+        return 0;
+    }
+    if(params.keyframeDays < 1 || params.outputQueueDays < 0) {
+        fprintf(stderr, "keyframe-days must be at least 1 and output-queue-days non-negative\n");
+        return 0;
+    }
+    if(params.engine != ENGINE_HOURLY && params.mosquitoModel != MOSQ_COUNTS) {
+        fprintf(stderr, "The next-reaction, tau-leap and phased engines need --mosquito-model counts\n");
+        return 0;
+    }
+    if(params.leapHours < 1) {
+        fprintf(stderr, "leap-hours must be at least 1\n");
+        return 0;
+    }
+    if(params.tauM < 0) {
+        fprintf(stderr, "tau-m must be non-negative\n");
+        return 0;
+    }
+    if(params.threads < 1 || params.threads > 256) {
+        fprintf(stderr, "threads must be between 1 and 256\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* ----------------- Initialization ----------------- */
+
+/* Resize every column of the human table to hold capacity agents */
+void growHumanTable(int capacity) {
+    humans.state        = reallocOrDie(humans.state,        capacity, sizeof(uint8_t));
+    humans.flags        = reallocOrDie(humans.flags,        capacity, sizeof(uint8_t));
+    humans.weight       = reallocOrDie(humans.weight,       capacity, sizeof(uint32_t));
+    humans.net          = reallocOrDie(humans.net,          capacity, sizeof(uint8_t));
+    humans.node         = reallocOrDie(humans.node,         capacity, sizeof(uint32_t));
+    humans.slot         = reallocOrDie(humans.slot,         capacity, sizeof(uint32_t));
+    humans.infectedDay  = reallocOrDie(humans.infectedDay,  capacity, sizeof(int32_t));
+    humans.treatmentDay = reallocOrDie(humans.treatmentDay, capacity, sizeof(int32_t));
+    humans.age          = reallocOrDie(humans.age,          capacity, sizeof(uint8_t));
+    humans.homeNet      = reallocOrDie(humans.homeNet,      capacity, sizeof(uint8_t));
+    humans.workNet      = reallocOrDie(humans.workNet,      capacity, sizeof(uint8_t));
+    humans.homeNode     = reallocOrDie(humans.homeNode,     capacity, sizeof(uint32_t));
+    humans.workNode     = reallocOrDie(humans.workNode,     capacity, sizeof(uint32_t));
+    humans.workStart    = reallocOrDie(humans.workStart,    capacity, sizeof(uint8_t));
+    humans.workEnd      = reallocOrDie(humans.workEnd,      capacity, sizeof(uint8_t));
+    humans.workDays     = reallocOrDie(humans.workDays,     capacity, sizeof(uint8_t));
+    humanCapacity = capacity;
+}
+
+/* Index of a new human agent, growing the table when full. Serial only. */
+int newHumanAgent() {
+    if(humanCount == humanCapacity) growHumanTable(humanCapacity * 2);
+    return humanCount++;
+}
+
+/* A new, unplaced agent sharing human p's age, home, work and routine */
+int newRelatedHuman(int p) {
+    int i = newHumanAgent();
+    humans.age[i]       = humans.age[p];
+    humans.homeNet[i]   = humans.homeNet[p];
+    humans.homeNode[i]  = humans.homeNode[p];
+    humans.workNet[i]   = humans.workNet[p];
+    humans.workNode[i]  = humans.workNode[p];
+    humans.workStart[i] = humans.workStart[p];
+    humans.workEnd[i]   = humans.workEnd[p];
+    humans.workDays[i]  = humans.workDays[p];
+    humans.net[i]       = NET_NONE;
+    return i;
+}
+
+void allocateSimulation() {
+    numNodes      = params.numHouses + params.numWorkplaces + params.numBreedingSites;
+    nodes         = allocOrDie(numNodes, sizeof(Node));
+    houses        = nodes;
+    workplaces    = houses + params.numHouses;
+    breedingSites = workplaces + params.numWorkplaces;
+
+    growHumanTable(params.numHumans / params.humanWeight + 1); /* Grows as infections split agents */
+
+    if(params.mosquitoModel == MOSQ_COUNTS) {
+        /* An exposure cohort turns infectious tauM days on, so its slot is
+           free again by the time the ring comes round */
+        cohortDays   = params.tauM + 1;
+        swarmCohorts = allocOrDie((size_t)numNodes * cohortDays, sizeof(int));
+    } else {
+        int nm = params.numMosquitoes;
+        mosquitoes.state      = allocOrDie(nm, sizeof(uint8_t));
+        mosquitoes.net        = allocOrDie(nm, sizeof(uint8_t));
+        mosquitoes.node       = allocOrDie(nm, sizeof(uint32_t));
+        mosquitoes.slot       = allocOrDie(nm, sizeof(uint32_t));
+        mosquitoes.generation = allocOrDie(nm, sizeof(uint32_t));
+        mosquitoes.exposedDay = allocOrDie(nm, sizeof(int32_t));
+        mosquitoes.age        = allocOrDie(nm, sizeof(uint8_t));
+        mosquitoes.breedNet   = allocOrDie(nm, sizeof(uint8_t));
+        mosquitoes.breedNode  = allocOrDie(nm, sizeof(uint32_t));
+        mosqFreeSlots         = allocOrDie(nm, sizeof(int));
+    }
+
+    itnHouses = allocOrDie(params.numHouses, sizeof(int));
+    calendars = allocOrDie(params.threads, sizeof(Calendar));
+
+    hourlyBitingProb = params.dailyBitingProb / (double)HOURS_PER_DAY;
+    stepBiteProb     = hourlyBitingProb;
+    stepMoveProb     = params.mosqMoveChance;
+    biteLogQ         = sparseLogQ(hourlyBitingProb);
+    moveLogQ         = sparseLogQ(params.mosqMoveChance);
+    humanDeathLogQ   = sparseLogQ(params.humanMortality);
+    mosqDeathLogQ    = sparseLogQ(params.mosqMortality);
+    recoveryLogQ        = sparseLogQ(params.humanRecovery);
+    treatedRecoveryLogQ = sparseLogQ(params.humanRecovery * 3.0); /* Treatment triples the recovery rate */
+}
+
+void initNetworks() {
+    Rng *r = &simRng;
+    for(int i=0; i<params.numHouses; i++){
+        /* Assign random coordinates */
+        houses[i].x = rngDouble(r) * params.gridSize;
+        houses[i].y = rngDouble(r) * params.gridSize;
+
+        /* NEW: Assign ITN protection to houses based on coverage */
+        houses[i].has_ITN = (rngDouble(r) < params.itnCoverage) ? 1 : 0;
+        if(houses[i].has_ITN) itnHouses[numItnHouses++] = i;
+    }
+
+    for(int i=0; i<params.numWorkplaces; i++){
+        /* Assign random coordinates */
+        workplaces[i].x = rngDouble(r) * params.gridSize;
+        workplaces[i].y = rngDouble(r) * params.gridSize;
+    }
+
+    for(int i=0; i<params.numBreedingSites; i++){
+        /* Assign random coordinates */
+        breedingSites[i].x = rngDouble(r) * params.gridSize;
+        breedingSites[i].y = rngDouble(r) * params.gridSize;
+    }
+
+    for(int net=0; net<NUM_NETWORKS; net++) buildDestinationTables(net);
+}
+
+void initPopulations() {
+    Rng *r = &simRng;
+    /* Humans: the initially infected first, in agents of at most splitWeight
+       people like those infection splits off, then everyone else in agents
+       of humanWeight */
+    int infected = params.initialInfectedHumans < params.numHumans ? params.initialInfectedHumans : params.numHumans;
+    for(int placed=0; placed<params.numHumans; ){
+        int isInfected = placed < infected;
+        int left = isInfected ? infected - placed : params.numHumans - placed;
+        int size = isInfected ? params.splitWeight : params.humanWeight;
+        if(size > left) size = left;
+        placed += size;
+
+        int i = newHumanAgent();
+        humans.state[i]        = STATE_S;
+        humans.flags[i]        = 0;
+        humans.weight[i]       = size;
+        humans.infectedDay[i]  = -1;
+        humans.age[i]          = rngBelow(r, 46) + 15;
+
+        humans.homeNet[i]  = 0; /* Houses */
+        humans.homeNode[i] = rngBelow(r, params.numHouses);
+        humans.workNet[i]  = 1; /* Workplaces */
+        humans.workNode[i] = rngBelow(r, params.numWorkplaces);
+
+        humans.net[i]      = NET_NONE;
+
+        /* NEW: Assign treatment status based on coverage, person by person.
+           If only some of the agent's people are treated they get a twin
+           agent of their own below, so every agent is wholly one or the other. */
+        int treated = size == 1 ? rngDouble(r) < params.treatmentRate
+                                : (int)rngBinomial(r, size, params.treatmentRate);
+        if(treated == size) humans.flags[i] |= HUMAN_TREATED;
+        humans.treatmentDay[i] = -1;
+
+        /* Daily routine */
+        int offset = 0;
+        if(params.shiftSpread > 0) offset = (int)rngBelow(r, 2 * params.shiftSpread + 1) - params.shiftSpread;
+        humans.workStart[i] = (params.workStart + offset + HOURS_PER_DAY) % HOURS_PER_DAY;
+        humans.workEnd[i]   = (params.workEnd + offset + HOURS_PER_DAY) % HOURS_PER_DAY;
+        humans.workDays[i]  = (1 << (DAYS_PER_WEEK - params.weekendDays)) - 1;
+        if(params.nonWorkerFrac > 0 && rngDouble(r) < params.nonWorkerFrac) humans.workDays[i] = 0;
+
+        int agents[2] = { i, -1 };
+        if(treated > 0 && treated < size) {
+            int twin = newRelatedHuman(i);
+            humans.state[twin]        = STATE_S;
+            humans.flags[twin]        = HUMAN_TREATED;
+            humans.weight[twin]       = treated;
+            humans.infectedDay[twin]  = -1;
+            humans.treatmentDay[twin] = -1;
+            humans.weight[i]          = size - treated;
+            agents[1] = twin;
+        }
+
+        for(int k=0; k<2 && agents[k] >= 0; k++){
+            int a = agents[k];
+            if(humanAtWork(a, 0)) moveHuman(a, humans.workNet[a], humans.workNode[a]);
+            else moveHuman(a, humans.homeNet[a], humans.homeNode[a]);
+
+            if(isInfected) {
+                setHumanState(a, STATE_I, 0);
+                humans.infectedDay[a] = 0;
+                scheduleRecovery(&calendars[0], r, a);
+            }
+        }
+    }
+
+    /* Mosquitoes. In the counts model they are only tallied at their
+       breeding site; otherwise every slot starts alive at generation 0. */
+    if(params.mosquitoModel == MOSQ_COUNTS) {
+        for(int i=0; i<params.numMosquitoes; i++){
+            int n = nodeIndex(2, rngBelow(r, params.numBreedingSites));
+            addSwarm(n, i < params.initialInfectedMosquitoes ? SWARM_I : SWARM_S, 1);
+        }
+    } else {
+        for(int i=0; i<params.numMosquitoes; i++){
+            mosquitoes.generation[i] = 0;
+            mosquitoes.state[i]      = MSTATE_S;
+            mosquitoes.exposedDay[i] = -1;
+            mosquitoes.age[i]        = rngBelow(r, 30) + 1;
+
+            mosquitoes.breedNet[i]  = 2; /* breedingSites */
+            mosquitoes.breedNode[i] = rngBelow(r, params.numBreedingSites);
+
+            mosquitoes.net[i] = NET_NONE;
+            moveMosquito(i, mosquitoes.breedNet[i], mosquitoes.breedNode[i]);
+
+            if(i < params.initialInfectedMosquitoes) {
+                setMosquitoState(i, MSTATE_I);
+            }
+        }
+    }
+    mosqAlive     = params.numMosquitoes;
+    mosqFreeCount = 0;
+
+    buildScheduleWheel();
+}
+
+/* ----------------- Output ----------------- */
+
+/* Results are streamed: recordStats() fills a DayStats snapshot at the end
+   of every day and writeDayStats() appends that day's rows to the output
+   files, so memory does not grow with the length of the run and the files
+   can be followed while it is going. Each day's rows are flushed as a
+   whole, so a run that dies leaves every day that reached the writer.
+
+   Formatting and writing happen on a separate output thread. Snapshots go
+   through a ring of output-queue-days slots with one producer (the
+   simulation) and one consumer (the writer). Two counting semaphores hand
+   slots back and forth and are the only synchronisation; when neither side
+   has to sleep, each hand-over is a single atomic operation and no lock is
+   taken. The simulation only waits when the writer is a whole queue of days
+   behind, which keeps memory bounded. With output-queue-days 0 the rows are
+   written inline instead. */
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+/* One day's results */
+typedef struct {
+    int  day;
+    int  S, I, R;
+    int  E_mos, I_mos;
+    int  totalHumans;
+    int  itnProtected;
+    int  treated;
+    int *houseInfected;      /* [numHouses] infected humans per house */
+} DayStats;
+
+DayStats *outputQueue;       /* [outputSlots] snapshots */
+int       outputSlots;
+unsigned  outputHead;        /* Next slot to fill, simulation thread only */
+unsigned  outputTail;        /* Next slot to write, output thread only */
+sem_t     outputFree, outputReady;
+pthread_t outputThread;
+
+FILE *binaryOut, *deltaOut;
+
+/* The CSV files are formatted by hand into a large buffer that goes out in
+   a single write when it fills or the day ends. Only integers change from
+   row to row: each house's "x,y,has_ITN" tail is printed with %.2f once
+   and copied after that, so the files are byte for byte what fprintf gave. */
+
+typedef struct {
+    FILE       *f;
+    const char *path;
+    char       *buf;          /* OUTPUT_BUFFER_SIZE bytes */
+    size_t      len;
+} CsvWriter;
+
+CsvWriter globalCsv, houseCsv;
+
+char *houseTails;            /* "x,y,has_ITN\n" of every house, back to back */
+int  *houseTailStart;        /* [numHouses + 1] offsets into houseTails */
+
+#define CSV_INT_CHARS 12     /* Longest int with its sign and a separator */
+
+/* results.bin is a columnar copy of both CSV files that typed-array readers
+   can map without parsing. All values are in host byte order (little-endian
+   on every machine the server targets):
+
+     BinaryHeader
+     BinaryColumn[numColumns]     directory, one entry per column
+     column data                  each column starts on an 8-byte boundary
+
+   A column is indexed by day (days values, row = day), by house (numHouses
+   values, row = houseID) or by day and house (days * numHouses values,
+   row = day * numHouses + houseID). The whole file is sized when it is
+   opened and each day fills its row of every column, so daysWritten in the
+   header says how many rows are valid if the run stopped early. */
+
+#define BINARY_MAGIC "MALSIM\0\0"
+#define BINARY_VERSION 1
+
+typedef enum { COLUMN_INT32, COLUMN_FLOAT64 } ColumnType;
+typedef enum { INDEX_DAY, INDEX_HOUSE, INDEX_DAY_HOUSE } ColumnIndex;
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t numColumns;
+    uint32_t numDays;
+    uint32_t daysWritten;
+    uint32_t numHouses;
+    uint32_t reserved;
+} BinaryHeader;
+
+typedef struct {
+    char     name[24];
+    uint32_t type;            /* ColumnType */
+    uint32_t index;           /* ColumnIndex */
+    uint64_t offset;          /* From the start of the file */
+    uint64_t length;          /* Values */
+} BinaryColumn;
+
+/* Columns of results.bin, in file order. The per-day ones follow the
+   global_stats.csv header; the house ones replace house_infected.csv. */
+enum {
+    COL_DAY, COL_S, COL_I, COL_R, COL_E_MOS, COL_I_MOS, COL_TOTAL_HUMANS,
+    COL_ITN_PROTECTED, COL_TREATED, COL_HOUSE_X, COL_HOUSE_Y, COL_HOUSE_ITN,
+    COL_HOUSE_INFECTED, NUM_BINARY_COLUMNS
+};
+
+BinaryColumn binaryColumns[NUM_BINARY_COLUMNS] = {
+    { "day",            COLUMN_INT32,   INDEX_DAY },
+    { "S",              COLUMN_INT32,   INDEX_DAY },
+    { "I",              COLUMN_INT32,   INDEX_DAY },
+    { "R",              COLUMN_INT32,   INDEX_DAY },
+    { "E_mos",          COLUMN_INT32,   INDEX_DAY },
+    { "I_mos",          COLUMN_INT32,   INDEX_DAY },
+    { "totalHumans",    COLUMN_INT32,   INDEX_DAY },
+    { "itn_protected",  COLUMN_INT32,   INDEX_DAY },
+    { "treated_humans", COLUMN_INT32,   INDEX_DAY },
+    { "x",              COLUMN_FLOAT64, INDEX_HOUSE },
+    { "y",              COLUMN_FLOAT64, INDEX_HOUSE },
+    { "has_ITN",        COLUMN_INT32,   INDEX_HOUSE },
+    { "infectedHumans", COLUMN_INT32,   INDEX_DAY_HOUSE }
+};
+
+BinaryHeader binaryHeader;
+
+FILE* openOutputFile(const char *path, const char *mode) {
+    FILE *f = fopen(path, mode);
+    if(!f) printf("Could not open %s for writing.\n", path);
+    return f;
+}
+
+/* Report any write that failed along the way, not only at the final flush:
+   the CSV files are unbuffered, so by now fclose() has nothing left to write */
+void closeOutputFile(FILE *f, const char *path) {
+    if(!f) return;
+    int failed = ferror(f);
+    if(fclose(f) == 0 && !failed) printf("%s written!\n", path);
+    else printf("Error writing %s.\n", path);
+}
+
+void csvFlush(CsvWriter *w) {
+    if(w->len) fwrite(w->buf, 1, w->len, w->f);
+    w->len = 0;
+}
+
+/* Where the next row goes, with room for at least n bytes */
+char* csvReserve(CsvWriter *w, size_t n) {
+    if(w->len + n > OUTPUT_BUFFER_SIZE) csvFlush(w);
+    return w->buf + w->len;
+}
+
+void csvCommit(CsvWriter *w, const char *end) {
+    w->len = end - w->buf;
+}
+
+void openCsv(CsvWriter *w, const char *path, const char *header) {
+    w->f = openOutputFile(path, "w");
+    if(!w->f) return;
+    setvbuf(w->f, NULL, _IONBF, 0);   /* The writer does its own buffering */
+    w->path = path;
+    w->buf  = allocOrDie(OUTPUT_BUFFER_SIZE, 1);
+    w->len  = strlen(header);
+    memcpy(w->buf, header, w->len);
+}
+
+void closeCsv(CsvWriter *w) {
+    if(!w->f) return;
+    csvFlush(w);
+    free(w->buf);
+    closeOutputFile(w->f, w->path);
+    w->f = NULL;
+}
+
+/* Write v in decimal followed by sep, return the end */
+char* putInt(char *p, int v, char sep) {
+    char digits[10];
+    int n = 0;
+    unsigned u = (unsigned)v;
+    if(v < 0) {
+        *p++ = '-';
+        u = 0u - u;
+    }
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while(u);
+    while(n) *p++ = digits[--n];
+    *p++ = sep;
+    return p;
+}
+
+void buildHouseTails() {
+    houseTailStart = allocOrDie(params.numHouses + 1, sizeof(int));
+    int total = 0;
+    for(int h=0; h<params.numHouses; h++){
+        houseTailStart[h] = total;
+        total += snprintf(NULL, 0, "%.2f,%.2f,%d\n", houses[h].x, houses[h].y, houses[h].has_ITN);
+    }
+    houseTailStart[params.numHouses] = total;
+    houseTails = allocOrDie(total + 1, 1);
+    for(int h=0; h<params.numHouses; h++){
+        sprintf(houseTails + houseTailStart[h], "%.2f,%.2f,%d\n", houses[h].x, houses[h].y, houses[h].has_ITN);
+    }
+}
+
+/* Bytes in house h's "x,y,has_ITN\n" tail */
+int houseTailLength(int h) {
+    return houseTailStart[h + 1] - houseTailStart[h];
+}
+
+/* Copy house h's tail to p, return the end */
+char* putHouseTail(char *p, int h) {
+    memcpy(p, houseTails + houseTailStart[h], houseTailLength(h));
+    return p + houseTailLength(h);
+}
+
+void writeAt(FILE *f, uint64_t offset, const void *data, size_t size) {
+    fseek(f, (long)offset, SEEK_SET);
+    fwrite(data, 1, size, f);
+}
+
+/* Lay out the columns, size the file and write everything that does not
+   change from day to day */
+FILE* openBinaryOutput(const char *path) {
+    FILE *f = openOutputFile(path, "wb");
+    if(!f) return NULL;
+
+    memcpy(binaryHeader.magic, BINARY_MAGIC, sizeof(binaryHeader.magic));
+    binaryHeader.version    = BINARY_VERSION;
+    binaryHeader.numColumns = NUM_BINARY_COLUMNS;
+    binaryHeader.numDays    = params.days;
+    binaryHeader.numHouses  = params.numHouses;
+
+    uint64_t offset = sizeof(BinaryHeader) + sizeof(binaryColumns);
+    for(int c=0; c<NUM_BINARY_COLUMNS; c++){
+        BinaryColumn *col = &binaryColumns[c];
+        size_t width = (col->type == COLUMN_FLOAT64) ? sizeof(double) : sizeof(int32_t);
+        col->length = (col->index == INDEX_DAY)   ? (uint64_t)params.days :
+                      (col->index == INDEX_HOUSE) ? (uint64_t)params.numHouses :
+                      (uint64_t)params.days * params.numHouses;
+        offset = (offset + 7) & ~(uint64_t)7;
+        col->offset = offset;
+        offset += col->length * width;
+    }
+
+    fwrite(&binaryHeader, sizeof(binaryHeader), 1, f);
+    fwrite(binaryColumns, sizeof(binaryColumns), 1, f);
+    writeAt(f, offset - 1, "", 1);
+
+    double  *coord = allocOrDie(params.numHouses, sizeof(double));
+    int32_t *itn   = allocOrDie(params.numHouses, sizeof(int32_t));
+    for(int h=0; h<params.numHouses; h++) coord[h] = houses[h].x;
+    writeAt(f, binaryColumns[COL_HOUSE_X].offset, coord, params.numHouses * sizeof(double));
+    for(int h=0; h<params.numHouses; h++) coord[h] = houses[h].y;
+    writeAt(f, binaryColumns[COL_HOUSE_Y].offset, coord, params.numHouses * sizeof(double));
+    for(int h=0; h<params.numHouses; h++) itn[h] = houses[h].has_ITN;
+    writeAt(f, binaryColumns[COL_HOUSE_ITN].offset, itn, params.numHouses * sizeof(int32_t));
+    free(coord);
+    free(itn);
+    return f;
+}
+
+/* house_changes.bin holds the house series as changes only. The house
+   attributes that never change go to houses.csv once instead. Integers are
+   unsigned LEB128 varints; signed ones are zigzag encoded first.
+
+     "MALDELTA"  then varints version, numHouses, numDays, keyframeDays
+     one record per day: varint payload length, then the payload
+       varint day
+       keyframe (day % keyframeDays == 0):
+         numHouses varints, the infected count of every house
+       otherwise:
+         varint number of houses that changed since the day before, then for
+         each, in house order, varint gap from the previous changed house
+         (houseID + 1 for the first) and zigzag varint change
+
+   Any day is rebuilt from the keyframe at or before it plus the days after
+   it. Records before the keyframe are skipped by their length without
+   decoding, so a reader never needs more than keyframeDays records. */
+
+#define DELTA_MAGIC "MALDELTA"
+#define DELTA_VERSION 1
+#define VARINT_MAX_BYTES 10
+
+int *deltaPrevious;          /* [numHouses] counts last written */
+unsigned char *deltaRecord;  /* Payload of the day being written */
+
+int putVarint(unsigned char *out, uint64_t v) {
+    int n = 0;
+    while(v >= 0x80) {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+FILE* openDeltaOutput(const char *path) {
+    CsvWriter houseTable = {0};
+    openCsv(&houseTable, "houses.csv", "houseID,x,y,has_ITN\n");
+    if(houseTable.f) {
+        for(int h=0; h<params.numHouses; h++){
+            char *p = csvReserve(&houseTable, CSV_INT_CHARS + houseTailLength(h));
+            p = putInt(p, h, ',');
+            csvCommit(&houseTable, putHouseTail(p, h));
+        }
+        closeCsv(&houseTable);
+    }
+
+    FILE *f = openOutputFile(path, "wb");
+    if(!f) return NULL;
+    setvbuf(f, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+    unsigned char header[8 + 4 * VARINT_MAX_BYTES];
+    int n = 8;
+    memcpy(header, DELTA_MAGIC, 8);
+    n += putVarint(header + n, DELTA_VERSION);
+    n += putVarint(header + n, params.numHouses);
+    n += putVarint(header + n, params.days);
+    n += putVarint(header + n, params.keyframeDays);
+    fwrite(header, 1, n, f);
+
+    deltaPrevious = allocOrDie(params.numHouses, sizeof(int));
+    deltaRecord   = allocOrDie((size_t)params.numHouses + 1, 2 * VARINT_MAX_BYTES);
+    return f;
+}
+
+void* outputMain(void *arg);
+
+void openOutput() {
+    outputSlots = params.outputQueueDays > 0 ? params.outputQueueDays : 1;
+    outputQueue = allocOrDie(outputSlots, sizeof(DayStats));
+    for(int i=0; i<outputSlots; i++){
+        outputQueue[i].houseInfected = allocOrDie(params.numHouses, sizeof(int));
+    }
+    buildHouseTails();
+    if(params.outputFormat != OUTPUT_BINARY) {
+        openCsv(&globalCsv, "global_stats.csv", "day,S,I,R,E_mos,I_mos,totalHumans,itn_protected,treated_humans\n");
+    }
+    if(params.outputFormat == OUTPUT_CSV || params.outputFormat == OUTPUT_BOTH) {
+        openCsv(&houseCsv, "house_infected.csv", "day,houseID,infectedHumans,x,y,has_ITN\n");
+    }
+    if(params.outputFormat == OUTPUT_BINARY || params.outputFormat == OUTPUT_BOTH) {
+        binaryOut = openBinaryOutput("results.bin");
+    }
+    if(params.outputFormat == OUTPUT_DELTA) {
+        deltaOut  = openDeltaOutput("house_changes.bin");
+    }
+
+    if(params.outputQueueDays == 0) return;
+    sem_init(&outputFree, 0, outputSlots);
+    sem_init(&outputReady, 0, 0);
+    if(pthread_create(&outputThread, NULL, outputMain, NULL) != 0) {
+        fprintf(stderr, "Could not start the output thread\n");
+        exit(1);
+    }
+}
+
+/* Fill row st->day of every per-day column, then publish it in the header */
+void writeBinaryDay(const DayStats *st) {
+    int32_t values[COL_TREATED + 1] = {
+        st->day, st->S, st->I, st->R, st->E_mos, st->I_mos,
+        st->totalHumans, st->itnProtected, st->treated
+    };
+    for(int c=0; c<=COL_TREATED; c++){
+        writeAt(binaryOut, binaryColumns[c].offset + (uint64_t)st->day * sizeof(int32_t),
+                &values[c], sizeof(int32_t));
+    }
+    writeAt(binaryOut, binaryColumns[COL_HOUSE_INFECTED].offset +
+                       (uint64_t)st->day * params.numHouses * sizeof(int32_t),
+            st->houseInfected, params.numHouses * sizeof(int32_t));
+
+    binaryHeader.daysWritten = st->day + 1;
+    writeAt(binaryOut, offsetof(BinaryHeader, daysWritten),
+            &binaryHeader.daysWritten, sizeof(binaryHeader.daysWritten));
+    fflush(binaryOut);
+}
+
+void writeDeltaDay(const DayStats *st) {
+    unsigned char *p = deltaRecord;
+    p += putVarint(p, st->day);
+    if(st->day % params.keyframeDays == 0) {
+        for(int h=0; h<params.numHouses; h++) p += putVarint(p, st->houseInfected[h]);
+    } else {
+        int changed = 0;
+        for(int h=0; h<params.numHouses; h++) changed += (st->houseInfected[h] != deltaPrevious[h]);
+        p += putVarint(p, changed);
+        int last = -1;
+        for(int h=0; h<params.numHouses; h++){
+            if(st->houseInfected[h] == deltaPrevious[h]) continue;
+            p += putVarint(p, h - last);
+            p += putVarint(p, zigzag((int64_t)st->houseInfected[h] - deltaPrevious[h]));
+            last = h;
+        }
+    }
+    memcpy(deltaPrevious, st->houseInfected, params.numHouses * sizeof(int));
+
+    unsigned char length[VARINT_MAX_BYTES];
+    size_t payload = p - deltaRecord;
+    fwrite(length, 1, putVarint(length, payload), deltaOut);
+    fwrite(deltaRecord, 1, payload, deltaOut);
+    fflush(deltaOut);
+}
+
+void writeDayStats(const DayStats *st) {
+    if(globalCsv.f) {
+        char *p = csvReserve(&globalCsv, 9 * CSV_INT_CHARS);
+        p = putInt(p, st->day, ',');
+        p = putInt(p, st->S, ',');
+        p = putInt(p, st->I, ',');
+        p = putInt(p, st->R, ',');
+        p = putInt(p, st->E_mos, ',');
+        p = putInt(p, st->I_mos, ',');
+        p = putInt(p, st->totalHumans, ',');
+        p = putInt(p, st->itnProtected, ',');
+        p = putInt(p, st->treated, '\n');
+        csvCommit(&globalCsv, p);
+        csvFlush(&globalCsv);
+    }
+    if(houseCsv.f) {
+        /* Every row of the day starts with the same "day," */
+        char prefix[CSV_INT_CHARS];
+        int prefixLen = putInt(prefix, st->day, ',') - prefix;
+        for(int h=0; h<params.numHouses; h++){
+            char *p = csvReserve(&houseCsv, prefixLen + 2 * CSV_INT_CHARS + houseTailLength(h));
+            memcpy(p, prefix, prefixLen);
+            p = putInt(p + prefixLen, h, ',');
+            p = putInt(p, st->houseInfected[h], ',');
+            csvCommit(&houseCsv, putHouseTail(p, h));
+        }
+        csvFlush(&houseCsv);
+    }
+    if(binaryOut) writeBinaryDay(st);
+    if(deltaOut) writeDeltaDay(st);
+}
+
+void* outputMain(void *arg) {
+    (void)arg;
+    for(;;) {
+        sem_wait(&outputReady);
+        DayStats *st = &outputQueue[outputTail++ % outputSlots];
+        if(st->day < 0) break;
+        writeDayStats(st);
+        sem_post(&outputFree);
+    }
+    return NULL;
+}
+
+/* The slot for today's snapshot, once the writer has finished with it */
+DayStats* nextDayStats() {
+    if(params.outputQueueDays == 0) return &outputQueue[0];
+    sem_wait(&outputFree);
+    return &outputQueue[outputHead % outputSlots];
+}
+
+void publishDayStats(DayStats *st) {
+    if(params.outputQueueDays == 0) {
+        writeDayStats(st);
+        return;
+    }
+    outputHead++;
+    sem_post(&outputReady);
+}
+
+void closeOutput() {
+    if(params.outputQueueDays > 0) {
+        DayStats *last = nextDayStats();
+        last->day = -1;               /* Tells the writer to stop */
+        publishDayStats(last);
+        pthread_join(outputThread, NULL);
+    }
+    closeCsv(&globalCsv);
+    closeCsv(&houseCsv);
+    closeOutputFile(binaryOut, "results.bin");
+    closeOutputFile(deltaOut, "house_changes.bin");
+}
+
+/* ----------------- Worker Threads ----------------- */
+
+/* The hourly and daily steps run as phases over a pool of --threads workers.
+   Every phase partitions either agents or nodes, one share per worker, and
+   a worker only ever writes to the nodes it owns. Agents are split into
+   contiguous ranges. Nodes are split network by network, so each worker owns
+   an ascending run of houses, of workplaces and of breeding sites. Whichever
+   network the humans or mosquitoes crowd into at a given hour, every worker
+   gets its share:
+
+   - Moves are decided per agent range and queued, then applied in two
+     passes: the owner of the old node detaches the agent, then the owner of
+     the new node attaches it.
+   - Infection and the daily state updates run per node range, touching only
+     the humans and mosquitoes at those nodes.
+   - The few pool-wide structures (the mosquito free stack, the transition
+     calendars) are drained serially from per-worker buffers between phases.
+
+   Each worker draws from its own RNG stream, or in deterministic mode from
+   streams keyed by the unit of work (see unitRng()). Per node, queued moves
+   are applied in global agent order, and killed mosquitoes and split humans
+   are drained network by network, worker by worker, which is node order. So
+   occupant list order, agent numbers, respawn slots and with them the whole
+   trajectory are then the same for every thread count. With --threads 1 the
+   phases run inline on the calling thread. */
+
+/* Kinds of queued move */
+#define MOVE_HUMAN        0
+#define MOVE_MOSQUITO     1
+#define MOVE_EVICTION     2   /* Mosquito chased out of a netted house */
+
+/* A queued relocation of one agent to (net, node) */
+typedef struct {
+    int      agent;
+    uint8_t  kind;
+    uint8_t  net;
+    uint32_t node;
+} Move;
+
+typedef struct {
+    Move *items;
+    int   count;
+    int   capacity;
+} MoveList;
+
+typedef struct {
+    int *items;
+    int  count;
+    int  capacity;
+} IntList;
+
+/* Counts model: `count` mosquitoes arriving in compartment comp of a node */
+typedef struct {
+    uint32_t node;
+    int      comp;
+    int      count;
+} Flow;
+
+typedef struct {
+    Flow *items;
+    int   count;
+    int   capacity;
+} FlowList;
+
+/* `weight` newly infected people to split off human agent `parent`. Flags
+   and treatment day are fixed at infection, as the parent may change before
+   the split is made. */
+typedef struct {
+    int      parent;
+    int      weight;
+    int32_t  treatmentDay;
+    uint8_t  flags;
+} Split;
+
+typedef struct {
+    Split *items;
+    int    count;
+    int    capacity;
+} SplitList;
+
+/* Per-thread state */
+typedef struct {
+    int       tid;
+    Rng       rng;
+    MoveList *detaches;      /* [numThreads] queued moves, bucketed by owner of the old node */
+    MoveList *attaches;      /* [numThreads] queued moves, bucketed by owner of the new node */
+    FlowList *arrivals;      /* [numThreads] counts model arrivals, bucketed by owner of the node */
+    int      *owned;         /* Nodes this worker owns, ascending, see startWorkers() */
+    int       numOwned;
+    IntList   killed[NUM_NETWORKS];  /* Mosquitoes killed this phase by network, slots not yet released */
+    SplitList splits[NUM_NETWORKS];  /* Infected groups to become agents by network, see createSplitHumans() */
+    IntList   biters;        /* Infectious mosquitoes biting at the current node */
+    IntList   scratch;
+    Calendar *calendar;      /* This worker's calendars[] entry */
+} Worker;
+
+typedef void (*PhaseFn)(Worker *w);
+
+/* Phases that draw random numbers, for unitRng() keys */
+enum { PHASE_MOVE, PHASE_EVICT, PHASE_INFECT, PHASE_UPDATE, PHASE_INFECT_LATE };
+
+#define RNG_BLOCK         4096  /* Agents per keyed stream in the agent phases */
+
+int       numThreads = 1;
+Worker   *workers;
+int      *nodeOwner;    /* Worker that owns each node, matching Worker.owned */
+
+PhaseFn           currentPhase;
+pthread_barrier_t phaseStart, phaseDone;
+pthread_t        *threads;
+int               poolQuit;
+
+/* This worker's share [begin, end) of n items */
+void workerRange(const Worker *w, long n, long *begin, long *end) {
+    *begin = n * w->tid / numThreads;
+    *end   = n * (w->tid + 1) / numThreads;
+}
+
+/* This worker's share of n agents, split on RNG_BLOCK boundaries */
+void workerBlocks(const Worker *w, long n, long *begin, long *end) {
+    long blocks = (n + RNG_BLOCK - 1) / RNG_BLOCK;
+    workerRange(w, blocks, begin, end);
+    *begin = *begin * RNG_BLOCK;
+    *end   = *end * RNG_BLOCK < n ? *end * RNG_BLOCK : n;
+}
+
+/* Random stream for one unit of work in a phase: a block of RNG_BLOCK agents,
+   a node or a netted house. In deterministic mode the stream is recreated from
+   (seed, hour, phase, unit), so the draws do not depend on which worker gets
+   the unit or what it drew before; otherwise the worker's stream carries on. */
+Rng* unitRng(Worker *w, int phase, long unit) {
+    if(params.deterministic) {
+        uint64_t key = (1ULL << 63) | ((uint64_t)hour << 36) | ((uint64_t)phase << 32) | (uint32_t)unit;
+        rngSeed(&w->rng, params.seed, key);
+    }
+    return &w->rng;
+}
+
+void pushInt(IntList *list, int value) {
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = reallocOrDie(list->items, list->capacity, sizeof(int));
+    }
+    list->items[list->count++] = value;
+}
+
+void pushMove(MoveList *list, Move move) {
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = reallocOrDie(list->items, list->capacity, sizeof(Move));
+    }
+    list->items[list->count++] = move;
+}
+
+void pushFlow(FlowList *list, Flow flow) {
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = reallocOrDie(list->items, list->capacity, sizeof(Flow));
+    }
+    list->items[list->count++] = flow;
+}
+
+void pushSplit(SplitList *list, Split split) {
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = reallocOrDie(list->items, list->capacity, sizeof(Split));
+    }
+    list->items[list->count++] = split;
+}
+
+void* workerMain(void *arg) {
+    Worker *w = arg;
+    for(;;) {
+        pthread_barrier_wait(&phaseStart);
+        if(poolQuit) break;
+        currentPhase(w);
+        pthread_barrier_wait(&phaseDone);
+    }
+    return NULL;
+}
+
+/* Run one phase on every worker and wait for all of them to finish.
+   The calling thread acts as worker 0. */
+void runPhase(PhaseFn fn) {
+    if(numThreads == 1) {
+        fn(&workers[0]);
+        return;
+    }
+    currentPhase = fn;
+    pthread_barrier_wait(&phaseStart);
+    fn(&workers[0]);
+    pthread_barrier_wait(&phaseDone);
+}
+
+void startWorkers() {
+    numThreads = params.threads;
+    workers    = allocOrDie(numThreads, sizeof(Worker));
+    nodeOwner  = allocOrDie(numNodes, sizeof(int));
+
+    for(int t=0; t<numThreads; t++){
+        Worker *w = &workers[t];
+        long begin, end;
+        w->tid      = t;
+        w->calendar = &calendars[t];
+        w->detaches = allocOrDie(numThreads, sizeof(MoveList));
+        w->attaches = allocOrDie(numThreads, sizeof(MoveList));
+        w->arrivals = allocOrDie(numThreads, sizeof(FlowList));
+        rngSeed(&w->rng, params.seed, 1 + t);
+
+        /* A range of every network; the networks follow one another in
+           nodes[], so the list comes out ascending */
+        w->owned = allocOrDie(numNodes, sizeof(int));
+        for(int net=0; net<NUM_NETWORKS; net++){
+            int first = nodeIndex(net, 0);
+            workerRange(w, networkSize(net), &begin, &end);
+            for(long k=begin; k<end; k++){
+                nodeOwner[first + k] = t;
+                w->owned[w->numOwned++] = first + k;
+            }
+        }
+    }
+
+    if(numThreads == 1) return;
+    pthread_barrier_init(&phaseStart, NULL, numThreads);
+    pthread_barrier_init(&phaseDone, NULL, numThreads);
+    threads = allocOrDie(numThreads, sizeof(pthread_t));
+    for(int t=1; t<numThreads; t++){
+        if(pthread_create(&threads[t], NULL, workerMain, &workers[t]) != 0) {
+            fprintf(stderr, "Could not start worker thread %d\n", t);
+            exit(1);
+        }
+    }
+}
+
+void stopWorkers() {
+    if(numThreads == 1) return;
+    poolQuit = 1;
+    pthread_barrier_wait(&phaseStart);
+    for(int t=1; t<numThreads; t++) pthread_join(threads[t], NULL);
+}
+
+/* ----------------- Simulation Steps ----------------- */
+
+/* Queue agent `agent` to move from global node oldIdx to (net, node) */
+void queueMove(Worker *w, int kind, int agent, int oldIdx, int net, int node) {
+    Move move = { agent, (uint8_t)kind, (uint8_t)net, (uint32_t)node };
+    pushMove(&w->detaches[nodeOwner[oldIdx]], move);
+    pushMove(&w->attaches[nodeOwner[nodeIndex(net, node)]], move);
+}
+
+/* Queue count mosquitoes of compartment comp to arrive at global node dest */
+void queueFlow(Worker *w, int dest, int comp, int count) {
+    pushFlow(&w->arrivals[nodeOwner[dest]], (Flow){ (uint32_t)dest, comp, count });
+}
+
+/* Send `movers` mosquitoes of compartment comp at node n into network net,
+   each to a destination drawn as selectDestination() would: one draw per
+   mover when they are fewer than the destinations, otherwise a multinomial
+   split over the destinations taken as a chain of binomials. Movers that
+   land on n itself or have nowhere to go stay. */
+void scatterSwarm(Worker *w, Rng *r, int n, int comp, int net, int movers) {
+    const DestTable *dest = &destTables[net];
+    long first = dest->start[n];
+    int  count = (int)(dest->start[n + 1] - first);
+
+    if(movers < count) {
+        for(int k=0; k<movers; k++){
+            int to = selectDestination(r, net, &nodes[n]);
+            if(to < 0 || nodeIndex(net, to) == n) continue;
+            addSwarm(n, comp, -1);
+            queueFlow(w, nodeIndex(net, to), comp, 1);
+        }
+        return;
+    }
+
+    int last = count - 1;
+    while(last >= 0 && dest->share[first + last] <= 0.0f) last--;
+    double rest = 1.0;  /* Share of the destinations not yet visited */
+    for(int j=0; j<=last && movers > 0; j++){
+        double share = dest->share[first + j];
+        int x = (j == last || share >= rest) ? movers : (int)rngBinomial(r, movers, share / rest);
+        int to = nodeIndex(net, dest->ids[first + j]);
+        rest   -= share;
+        movers -= x;
+        if(x == 0 || to == n) continue;
+        addSwarm(n, comp, -x);
+        queueFlow(w, to, comp, x);
+    }
+}
+
+/* Hourly moves of the swarm at node n, following the agent rules: each
+   mosquito leaves with probability mosqMoveChance (stepMoveProb over a
+   longer step), at night for a house or
+   a workplace with even odds and by day for a breeding site, and anything
+   in a netted house is driven out to random breeding sites instead. */
+void moveSwarm(Worker *w, Rng *r, int n, int night) {
+    for(int comp=0; comp<swarmCompartments(); comp++){
+        int count = swarmCount(n, comp);
+        if(count == 0) continue;
+
+        if(n < params.numHouses && houses[n].has_ITN) {
+            for(int k=0; k<count; k++){
+                queueFlow(w, nodeIndex(2, rngBelow(r, params.numBreedingSites)), comp, 1);
+            }
+            addSwarm(n, comp, -count);
+            continue;
+        }
+
+        int movers = (int)rngBinomial(r, count, stepMoveProb);
+        if(night) {
+            int toHouses = (int)rngBinomial(r, movers, 0.5);
+            scatterSwarm(w, r, n, comp, 0, toHouses);
+            scatterSwarm(w, r, n, comp, 1, movers - toHouses);
+        } else {
+            scatterSwarm(w, r, n, comp, 2, movers);
+        }
+    }
+}
+
+/* Humans: move between home and work, visiting only those departing now
+   and those split off since the wheel was built */
+void decideHumanMovesPhase(Worker *w) {
+    int hourOfWeek = hour % HOURS_PER_WEEK;
+    long begin, end;
+
+    int *departing = &wheelHumans[wheelStart[hourOfWeek]];
+    long numDeparting = wheelStart[hourOfWeek + 1] - wheelStart[hourOfWeek];
+    workerRange(w, numDeparting + numWheelPending, &begin, &end);
+    for(long k=begin; k<end; k++){
+        int i = k < numDeparting ? departing[k] : wheelPending[k - numDeparting];
+        if(humans.state[i] == STATE_DEAD) continue;
+        int net, node;
+        if(humanTarget(i, hourOfWeek, &net, &node)) {
+            queueMove(w, MOVE_HUMAN, i, nodeIndex(humans.net[i], humans.node[i]), net, node);
+        }
+    }
+}
+
+void decideMosquitoMovesPhase(Worker *w) {
+    int currentHour = hour % 24;
+    long begin, end;
+
+    if(params.mosquitoModel == MOSQ_COUNTS) {
+        for(int k=0; k<w->numOwned; k++){
+            int n = w->owned[k];
+            if(swarmTotal(n) == 0) continue;
+            moveSwarm(w, unitRng(w, PHASE_MOVE, n), n, currentHour > 18 || currentHour < 6);
+        }
+        return;
+    }
+
+    /* Normal mosquito movement logic, visiting only the mosquitoes that move.
+       Mosquitoes sitting in a house with bed nets are evicted below instead. */
+    workerBlocks(w, params.numMosquitoes, &begin, &end);
+    for(long block=begin; block<end; block+=RNG_BLOCK){
+        Rng *r = unitRng(w, PHASE_MOVE, block / RNG_BLOCK);
+        long blockEnd = block + RNG_BLOCK < end ? block + RNG_BLOCK : end;
+
+        for(long i = nextFiring(r, block - 1, blockEnd, moveLogQ); i < blockEnd; i = nextFiring(r, i, blockEnd, moveLogQ)){
+            if(mosquitoes.state[i] == MSTATE_DEAD) continue;
+            int net = mosquitoes.net[i];
+            if(net == 0 && getNode(net, mosquitoes.node[i])->has_ITN) continue;
+
+            Node *from = getNode(net, mosquitoes.node[i]);
+            int newNet, newNode;
+            if(currentHour > 18 || currentHour < 6) {
+                /* House or workplace at night */
+                if(rngDouble(r) < 0.5){
+                    newNet = 0;
+                    /* Use spatial selection for destination - ITN protection handled in selectDestination */
+                    newNode = selectDestination(r, newNet, from);
+                } else {
+                    newNet = 1;
+                    newNode = selectDestination(r, newNet, from);
+                }
+            } else {
+                /* Breeding site in daytime */
+                newNet = 2;
+                newNode = selectDestination(r, newNet, from);
+            }
+
+            /* Only move if the destination is different from current location */
+            if(newNode >= 0 && (newNet != net || (uint32_t)newNode != mosquitoes.node[i])) {
+                queueMove(w, MOVE_MOSQUITO, i, (int)(from - nodes), newNet, newNode);
+            }
+        }
+    }
+
+    /* Remove mosquitoes from houses with bed nets: move them to a random breeding site.
+       Destinations never include netted houses, so only earlier occupants are affected. */
+    workerRange(w, numItnHouses, &begin, &end);
+    for(long h=begin; h<end; h++){
+        Rng *r = unitRng(w, PHASE_EVICT, h);
+        OccupantList *occupants = &houses[itnHouses[h]].mosquitoes;
+        for(int k=0; k<occupants->count; k++){
+            int bID = rngBelow(r, params.numBreedingSites);
+            queueMove(w, MOVE_EVICTION, occupants->ids[k], itnHouses[h], 2, bID);
+        }
+    }
+}
+
+void decideMovesPhase(Worker *w) {
+    decideHumanMovesPhase(w);
+    decideMosquitoMovesPhase(w);
+}
+
+/* First half of applying queued moves: owners of the old nodes detach */
+void detachPhase(Worker *w) {
+    for(int src=0; src<numThreads; src++){
+        MoveList *list = &workers[src].detaches[w->tid];
+        for(int k=0; k<list->count; k++){
+            Move *move = &list->items[k];
+            if(move->kind == MOVE_HUMAN) detachHuman(move->agent);
+            else detachMosquito(move->agent);
+        }
+        list->count = 0;
+    }
+}
+
+/* Second half: owners of the new nodes attach. Evictions go last, so every
+   breeding site sees its arrivals in the same order whatever the split. */
+void attachPhase(Worker *w) {
+    for(int evictions=0; evictions<2; evictions++){
+        for(int src=0; src<numThreads; src++){
+            MoveList *list = &workers[src].attaches[w->tid];
+            for(int k=0; k<list->count; k++){
+                Move *move = &list->items[k];
+                if((move->kind == MOVE_EVICTION) != evictions) continue;
+                if(move->kind == MOVE_HUMAN) attachHuman(move->agent, move->net, move->node);
+                else attachMosquito(move->agent, move->net, move->node);
+            }
+        }
+    }
+    for(int src=0; src<numThreads; src++){
+        workers[src].attaches[w->tid].count = 0;
+    }
+
+    /* Counts model arrivals; these commute, so their order does not matter */
+    for(int src=0; src<numThreads; src++){
+        FlowList *list = &workers[src].arrivals[w->tid];
+        for(int k=0; k<list->count; k++){
+            addSwarm(list->items[k].node, list->items[k].comp, list->items[k].count);
+        }
+        list->count = 0;
+    }
+}
+
+/* Decide moves with `decide`, then carry them out */
+void applyMoves(PhaseFn decide) {
+    runPhase(decide);
+    runPhase(detachPhase);
+    runPhase(attachPhase);
+}
+
+void scheduleMovement() {
+    applyMoves(decideMovesPhase);
+}
+
+/* Infect human H after an infectious bite. Treatment is decided with the
+   infection so the node counters and the recovery draw see it. */
+void infectHuman(Worker *w, Rng *r, int H) {
+    int treat = 0;
+    if(rngDouble(r) < params.treatmentRate) {
+        treat = HUMAN_TREATED;
+        humans.treatmentDay[H] = day;
+    }
+
+    setHumanState(H, STATE_I, treat);
+    humans.infectedDay[H] = day;
+    scheduleRecovery(w->calendar, r, H);
+}
+
+/* k of the people in human agent H are infected. Treatment is drawn for
+   each of them, and the infected leave H in groups of at most splitWeight
+   people, each becoming an agent of its own; H itself becomes the first
+   group if nobody is left. New agents are created serially afterwards by
+   createSplitHumans(), so agent numbers do not depend on the thread split.
+   Splitting the infected off keeps the early outbreak, and each infected
+   group's recovery, as stochastic as the split weight allows. */
+void infectGroup(Worker *w, Rng *r, int H, int k) {
+    int treated = (int)rngBinomial(r, k, params.treatmentRate);
+    int groups[2] = { k - treated, treated };
+    int inPlace = k == (int)humans.weight[H];
+
+    setHumanWeight(H, humans.weight[H] - k);
+    for(int g=0; g<2; g++){
+        int flags = g ? HUMAN_TREATED : 0;
+        for(int left = groups[g]; left > 0; ){
+            int size = left < params.splitWeight ? left : params.splitWeight;
+            left -= size;
+            if(inPlace) {
+                inPlace = 0;
+                setHumanWeight(H, size);
+                if(flags) humans.treatmentDay[H] = day;
+                setHumanState(H, STATE_I, flags);
+                humans.infectedDay[H] = day;
+                scheduleRecovery(w->calendar, r, H);
+            } else {
+                int32_t treatmentDay = flags ? day : humans.treatmentDay[H];
+                pushSplit(&w->splits[humans.net[H]], (Split){ H, size, treatmentDay, (uint8_t)(humans.flags[H] | flags) });
+            }
+        }
+    }
+}
+
+/* A mosquito killed while its node is being processed: taken out at once,
+   its slot released serially by releaseKilledMosquitoes() */
+void markKilled(Worker *w, int i) {
+    pushInt(&w->killed[mosquitoes.net[i]], i);
+    detachMosquito(i);
+    mosquitoes.state[i] = MSTATE_DEAD;
+}
+
+/* Infect each susceptible human at node with probability pOpen, or pNet
+   under a bed net. Returns how many of them sleep under a net. */
+int exposeHumans(Worker *w, Rng *r, Node *node, double pOpen, double pNet) {
+    int itnTargets = 0;
+
+    for(int h=0; h<node->humans.count; h++){
+        int H = node->humans.ids[h];
+        if(humans.state[H] != STATE_S) continue;
+        int netted = humans.flags[H] & HUMAN_HAS_ITN;
+        if(netted) itnTargets += humans.weight[H];
+        if(humans.weight[H] > 1) {
+            int k = (int)rngBinomial(r, humans.weight[H], netted ? pNet : pOpen);
+            if(k > 0) infectGroup(w, r, H, k);
+        } else if(rngDouble(r) < (netted ? pNet : pOpen)) {
+            infectHuman(w, r, H);
+        }
+    }
+    return itnTargets;
+}
+
+/* Node kernel: with b mosquitoes biting at a node this hour, each susceptible
+   human escapes each bite independently, so it is infected with probability
+   1 - (1 - bMosToHuman * ITN factor)^b. This is the same per-human marginal as
+   the per-mosquito loop, drawn once per human instead of once per biter.
+   Returns how many of the susceptible humans sleep under a net. */
+int biteHumans(Worker *w, Rng *r, Node *node, int k) {
+    double pOpen = 1.0 - pow(1.0 - params.bMosToHuman, k);
+    double pNet  = 1.0 - pow(1.0 - params.bMosToHuman * (1.0 - params.itnEfficacy), k);
+    return exposeHumans(w, r, node, pOpen, pNet);
+}
+
+void applyNodeBites(Worker *w, Rng *r, Node *node, const IntList *biters) {
+    int itnTargets = biteHumans(w, r, node, biters->count);
+
+    /* A biter that meets n netted susceptible humans survives each net with
+       probability 1 - itnKillProb */
+    if(itnTargets == 0) return;
+    double pKill = 1.0 - pow(1.0 - params.itnKillProb, itnTargets);
+    for(int j=0; j<biters->count; j++){
+        if(rngDouble(r) < pKill) markKilled(w, biters->items[j]);
+    }
+}
+
+/* Collect the mosquitoes in list positions [begin, end) that bite this hour */
+void sampleBiters(Rng *r, const Node *node, long begin, long end, IntList *out) {
+    for(long j = nextFiring(r, begin - 1, end, biteLogQ); j < end; j = nextFiring(r, j, end, biteLogQ)){
+        pushInt(out, node->mosquitoes.ids[j]);
+    }
+}
+
+/* Bites at one node. Every infection event starts with a bite (probability
+   hourlyBitingProb), so only the mosquitoes that bite this hour are visited,
+   and only from the segments that can produce an event: susceptible
+   mosquitoes where someone is infectious, infectious ones where someone is
+   susceptible. Biters are drawn up front because resolving them reorders the
+   list. Susceptible biters feed first, on the humans as they were at the
+   start of the hour. */
+void infectAtNode(Worker *w, int n) {
+    Rng *r = unitRng(w, PHASE_INFECT, n);
+    Node *node = &nodes[n];
+    long nS = node->mosqStates[MSTATE_S];
+    long nI = node->mosqStates[MSTATE_I];
+    IntList *feeders = &w->scratch;
+    IntList *biters  = &w->biters;
+
+    feeders->count = biters->count = 0;
+    if(node->humanStates[STATE_I] > 0) sampleBiters(r, node, 0, nS, feeders);
+    if(node->humanStates[STATE_S] > 0) sampleBiters(r, node, nS, nS + nI, biters);
+
+    /* Susceptible: maybe get infected from local infected humans. Treated
+       humans transmit less; the weight caps at one infectious human's worth,
+       since any untreated infectious human already makes a bite infectious. */
+    if(feeders->count > 0) {
+        double weight = fmin(1.0, infectiousWeight(node));
+        for(int j=0; j<feeders->count; j++){
+            int i = feeders->items[j];
+            if(rngDouble(r) < params.cHumanToMos * weight){
+                setMosquitoState(i, MSTATE_E);
+                mosquitoes.exposedDay[i] = day;
+                scheduleIncubation(w->calendar, i);
+            }
+        }
+    }
+
+    if(biters->count == 0) return;
+    if(params.infectionKernel == KERNEL_NODE) {
+        applyNodeBites(w, r, node, biters);
+        return;
+    }
+
+    int localCount   = node->humans.count;
+    int *localHumans = node->humans.ids;
+    for(int j=0; j<biters->count; j++){
+        int i = biters->items[j];
+
+        /* Infect humans with prob bMosToHuman */
+        for(int h=0; h<localCount; h++){
+            int H = localHumans[h];
+            if(humans.state[H] == STATE_S){
+                /* Apply ITN protection if human has one. A super-individual
+                   puts all its people's nets in the mosquito's way at once. */
+                int weight = humans.weight[H];
+                double effectiveBiteProb = 1.0;
+                if(humans.flags[H] & HUMAN_HAS_ITN) {
+                    effectiveBiteProb *= (1.0 - params.itnEfficacy);
+
+                    /* Mosquito mortality from ITN contact */
+                    double pKill = weight > 1 ? 1.0 - pow(1.0 - params.itnKillProb, weight) : params.itnKillProb;
+                    if(rngDouble(r) < pKill) {
+                        markKilled(w, i);
+                        break; /* Mosquito is dead, exit loop */
+                    }
+                }
+
+                if(weight > 1) {
+                    int k = (int)rngBinomial(r, weight, params.bMosToHuman * effectiveBiteProb);
+                    if(k > 0) infectGroup(w, r, H, k);
+                } else if(rngDouble(r) < params.bMosToHuman * effectiveBiteProb){
+                    infectHuman(w, r, H);
+                }
+            }
+        }
+    }
+}
+
+/* Bites at node n in the counts model. Feeding and biting are binomial
+   draws on the S and I counts; humans are infected through the node kernel
+   whatever --infection-kernel says, since the per-mosquito kernel needs to
+   know which mosquito bit whom. Susceptible feeders that pick up the
+   parasite join today's exposure cohort, and biters die on nets as in
+   applyNodeBites(). */
+void infectSwarm(Worker *w, int n) {
+    Node *node = &nodes[n];
+    int nS = node->mosqStates[MSTATE_S];
+    int nI = node->mosqStates[MSTATE_I];
+    if(nS == 0 && nI == 0) return;
+    Rng *r = unitRng(w, PHASE_INFECT, n);
+
+    int exposed = 0, biters = 0;
+    if(node->humanStates[STATE_I] > 0) {
+        double weight = fmin(1.0, infectiousWeight(node));
+        exposed = (int)rngBinomial(r, nS, stepBiteProb * params.cHumanToMos * weight);
+    }
+    if(node->humanStates[STATE_S] > 0) biters = (int)rngBinomial(r, nI, stepBiteProb);
+
+    if(exposed > 0) {
+        addSwarm(n, SWARM_S, -exposed);
+        addSwarm(n, SWARM_E + day % cohortDays, exposed);
+    }
+    if(biters == 0) return;
+
+    int itnTargets = biteHumans(w, r, node, biters);
+    if(itnTargets == 0) return;
+    int killed = (int)rngBinomial(r, biters, 1.0 - pow(1.0 - params.itnKillProb, itnTargets));
+    addSwarm(n, SWARM_I, -killed);
+}
+
+/* Nodes without humans, which is every breeding site and all empty houses
+   or workplaces, cost one check per hour */
+void infectionPhase(Worker *w) {
+    for(int k=0; k<w->numOwned; k++){
+        int n = w->owned[k];
+        Node *node = &nodes[n];
+        if(node->humans.count == 0) continue;
+        if(params.mosquitoModel == MOSQ_COUNTS) infectSwarm(w, n);
+        else if(node->mosquitoes.count > 0) infectAtNode(w, n);
+    }
+}
+
+/* Return the slots of every mosquito killed during the last phase to the free
+   stack. Within a network, workers own ascending node ranges and fill their
+   lists node by node, so slots are pushed in node order and respawns reuse
+   them in the same order for any thread count. */
+void releaseKilledMosquitoes() {
+    for(int net=0; net<NUM_NETWORKS; net++){
+        for(int t=0; t<numThreads; t++){
+            IntList *killed = &workers[t].killed[net];
+            for(int k=0; k<killed->count; k++){
+                releaseMosquitoSlot(killed->items[k]);
+            }
+            killed->count = 0;
+        }
+    }
+}
+
+/* Turn the groups queued by infectGroup() into agents at their parent's
+   node. Within a network, workers fill their lists node by node over
+   ascending node ranges, so agents are numbered, and recoveries drawn, in
+   the same order for any thread count. */
+void createSplitHumans() {
+    for(int net=0; net<NUM_NETWORKS; net++){
+        for(int t=0; t<numThreads; t++){
+            SplitList *splits = &workers[t].splits[net];
+            for(int k=0; k<splits->count; k++){
+                Split *split = &splits->items[k];
+                int p = split->parent;
+                int i = newRelatedHuman(p);
+
+                humans.state[i]        = STATE_I;
+                humans.flags[i]        = split->flags;
+                humans.weight[i]       = split->weight;
+                humans.infectedDay[i]  = day;
+                humans.treatmentDay[i] = split->treatmentDay;
+
+                attachHuman(i, humans.net[p], humans.node[p]);
+                scheduleRecovery(&calendars[0], &simRng, i);
+                addPendingHuman(i);
+            }
+            splits->count = 0;
+        }
+    }
+}
+
+void handleInfections() {
+    runPhase(infectionPhase);
+    releaseKilledMosquitoes();
+    createSplitHumans();
+}
+
+/* Daily step for the swarm at node n: the cohort exposed tauM days ago turns
+   infectious, then every compartment loses Binomial(count, mosqMortality).
+   The next-reaction engine kills mosquitoes as they go instead. */
+void updateSwarm(Rng *r, int n) {
+    int due   = SWARM_E + (day + 1) % cohortDays;
+    int count = swarmCount(n, due);
+    addSwarm(n, due, -count);
+    addSwarm(n, SWARM_I, count);
+    if(params.engine == ENGINE_NEXT_REACTION) return;
+
+    for(int comp=0; comp<swarmCompartments(); comp++){
+        count = swarmCount(n, comp);
+        if(count > 0) addSwarm(n, comp, -(int)rngBinomial(r, count, params.mosqMortality));
+    }
+}
+
+/* Daily deaths for the agents at one node */
+void updateNode(Worker *w, int n) {
+    Rng *r = unitRng(w, PHASE_UPDATE, n);
+    Node *node = &nodes[n];
+
+    /* Mortality, visiting only the humans that die. Super-individuals lose
+       Binomial(weight, humanMortality) people and die once none are left. */
+    long count = node->humans.count;
+    w->scratch.count = 0;
+    if(params.humanWeight > 1 || params.splitWeight > 1) {
+        for(long h=0; h<count; h++){
+            int H = node->humans.ids[h];
+            int deaths = (int)rngBinomial(r, humans.weight[H], params.humanMortality);
+            if(deaths == (int)humans.weight[H]) pushInt(&w->scratch, H);
+            else if(deaths > 0) setHumanWeight(H, humans.weight[H] - deaths);
+        }
+    } else {
+        for(long h = nextFiring(r, -1, count, humanDeathLogQ); h < count; h = nextFiring(r, h, count, humanDeathLogQ)){
+            pushInt(&w->scratch, node->humans.ids[h]);
+        }
+    }
+    for(int k=0; k<w->scratch.count; k++){
+        detachHuman(w->scratch.items[k]);
+        humans.state[w->scratch.items[k]] = STATE_DEAD;
+    }
+
+    if(params.mosquitoModel == MOSQ_COUNTS) {
+        updateSwarm(r, n);
+        return;
+    }
+
+    /* Mosquito mortality, visiting only the mosquitoes that die */
+    count = node->mosquitoes.count;
+    w->scratch.count = 0;
+    for(long m = nextFiring(r, -1, count, mosqDeathLogQ); m < count; m = nextFiring(r, m, count, mosqDeathLogQ)){
+        pushInt(&w->scratch, node->mosquitoes.ids[m]);
+    }
+    for(int k=0; k<w->scratch.count; k++){
+        markKilled(w, w->scratch.items[k]);
+    }
+}
+
+void updatePhase(Worker *w) {
+    for(int k=0; k<w->numOwned; k++){
+        updateNode(w, w->owned[k]);
+    }
+}
+
+/* Counts model repopulation: new susceptibles at random breeding sites until
+   mosqMinAlive are alive, never more than --mosquitoes in all. Serial. */
+void respawnSwarms() {
+    long alive = 0;
+    for(int n=0; n<numNodes; n++) alive += swarmTotal(n);
+
+    long target = params.mosqMinAlive < params.numMosquitoes ? params.mosqMinAlive : params.numMosquitoes;
+    for(; alive < target; alive++){
+        addSwarm(nodeIndex(2, rngBelow(&simRng, params.numBreedingSites)), SWARM_S, 1);
+    }
+    mosqAlive = (int)alive;
+}
+
+void updateStates() {
+    /* Recoveries and end of incubation, only for the agents due today */
+    runDueTransitions();
+
+    runPhase(updatePhase);
+    releaseKilledMosquitoes();
+    if(day % DAYS_PER_WEEK == DAYS_PER_WEEK - 1) compactScheduleWheel();
+
+    if(params.mosquitoModel == MOSQ_COUNTS) {
+        respawnSwarms();
+        return;
+    }
+
+    /* Repopulate mosquitoes if below mosqMinAlive alive, reusing dead slots */
+    while(mosqAlive < params.mosqMinAlive) {
+        if(spawnMosquito(&simRng) < 0) break; /* Every slot is already alive */
+    }
+}
+
+/* Gather the day's stats and hand them to the output */
+void recordStats() {
+    long counts[STATE_DEAD] = {0};
+    long mcounts[MSTATE_DEAD] = {0};
+    long itn_count=0, treat_count=0;
+
+    /* Every living agent is at exactly one node, so the node counters add up
+       to the population totals */
+    for(int n=0; n<numNodes; n++){
+        for(int s=0; s<STATE_DEAD; s++) counts[s] += nodes[n].humanStates[s];
+        for(int s=0; s<MSTATE_DEAD; s++) mcounts[s] += nodes[n].mosqStates[s];
+        itn_count   += nodes[n].netted;
+        treat_count += nodes[n].treated;
+    }
+    int totalH = counts[STATE_S] + counts[STATE_I] + counts[STATE_R];
+
+    DayStats *st = nextDayStats();
+    st->day         = day;
+    st->S           = counts[STATE_S];
+    st->I           = counts[STATE_I];
+    st->R           = counts[STATE_R];
+    st->E_mos       = mcounts[MSTATE_E];
+    st->I_mos       = mcounts[MSTATE_I];
+    st->totalHumans = totalH;
+
+    /* Record intervention stats */
+    st->itnProtected = itn_count;
+    st->treated      = treat_count;
+
+    /* House-level: count infected per house */
+    for(int h=0; h<params.numHouses; h++){
+        st->houseInfected[h] = houses[h].humanStates[STATE_I];
+    }
+    publishDayStats(st);
+}
+
+/* ----------------- Event Engines ----------------- */
+
+/* Alternatives to stepping every hour, both on the counts mosquito model.
+   Humans still keep their hourly schedules and the daily steps (recovery,
+   incubation, deaths, respawns) still run at the end of each day.
+
+   next-reaction: exact continuous time in the manner of Gibson and Bruck.
+   Every node is one reaction channel whose propensity sums its mosquito
+   events: moves (rate -log(1 - mosqMoveChance) per mosquito-hour), deaths
+   (the daily mortality spread over the day), feeds by susceptibles that
+   pick up the parasite, and bites by infectious mosquitoes. Nodes sit in an
+   indexed heap keyed on their next firing time; when a node's propensity
+   changes its pending time is rescaled rather than redrawn, so an event
+   costs one draw plus O(log nodes) and quiet hours cost nothing but the
+   human departures. A bite infects each susceptible human at the node with
+   the node kernel's one-bite probability. Runs serially.
+
+   tau-leap: the hourly counts step stretched over up to --leap-hours hours
+   while no human departs and night does not turn to day or back, with the
+   per-step move and bite probabilities compounded over the leap. Each
+   mosquito then moves and bites at most once per leap.
+
+   phased: one step per phase of the day, a phase running from one human
+   departure or night/day switch to the next (with the default schedule
+   0-6, 6-8, 8-18, 18-19 and 19-24). Within a phase humans stand still, so
+   exposure is integrated in closed form over each half of the phase, with
+   all the mosquito moves of the phase made in aggregate in between. */
+
+enum { REACT_MOVE, REACT_DEATH, REACT_FEED, REACT_BITE, NUM_REACTIONS };
+
+double moveRate, biteRate, mosqDeathRate;  /* Per mosquito-hour */
+
+double *reactionTime;   /* [numNodes] next firing, INFINITY while the node is idle */
+double *reactionRate;   /* [numNodes] propensity reactionTime was drawn for */
+int    *reactionHeap;   /* Nodes, earliest firing first */
+int    *reactionPos;    /* Heap position of every node */
+
+void swapReactions(int a, int b) {
+    int x = reactionHeap[a], y = reactionHeap[b];
+    reactionHeap[a] = y; reactionPos[y] = a;
+    reactionHeap[b] = x; reactionPos[x] = b;
+}
+
+/* Restore the heap around position k after its time changed */
+void siftReaction(int k) {
+    while(k > 0 && reactionTime[reactionHeap[k]] < reactionTime[reactionHeap[(k - 1) / 2]]) {
+        swapReactions(k, (k - 1) / 2);
+        k = (k - 1) / 2;
+    }
+    for(;;) {
+        int c = 2 * k + 1;
+        if(c >= numNodes) break;
+        if(c + 1 < numNodes && reactionTime[reactionHeap[c + 1]] < reactionTime[reactionHeap[c]]) c++;
+        if(reactionTime[reactionHeap[c]] >= reactionTime[reactionHeap[k]]) break;
+        swapReactions(k, c);
+        k = c;
+    }
+}
+
+void startReactions() {
+    moveRate      = -log1p(-fmin(params.mosqMoveChance, 1.0 - 1e-12));
+    biteRate      = -log1p(-fmin(hourlyBitingProb, 1.0 - 1e-12));
+    mosqDeathRate = -log1p(-fmin(params.mosqMortality, 1.0 - 1e-12)) / HOURS_PER_DAY;
+
+    reactionTime = allocOrDie(numNodes, sizeof(double));
+    reactionRate = allocOrDie(numNodes, sizeof(double));
+    reactionHeap = allocOrDie(numNodes, sizeof(int));
+    reactionPos  = allocOrDie(numNodes, sizeof(int));
+    for(int n=0; n<numNodes; n++){
+        reactionTime[n] = INFINITY;
+        reactionHeap[n] = reactionPos[n] = n;
+    }
+}
+
+/* Channel propensities at node n into a[], per hour; returns their sum */
+double nodePropensities(int n, double *a) {
+    const Node *node = &nodes[n];
+    int total = swarmTotal(n);
+    a[REACT_MOVE]  = total * moveRate;
+    a[REACT_DEATH] = total * mosqDeathRate;
+    a[REACT_FEED]  = node->humanStates[STATE_I] > 0
+                   ? node->mosqStates[MSTATE_S] * biteRate * params.cHumanToMos * fmin(1.0, infectiousWeight(node)) : 0.0;
+    a[REACT_BITE]  = node->humanStates[STATE_S] > 0 ? node->mosqStates[MSTATE_I] * biteRate : 0.0;
+    return a[REACT_MOVE] + a[REACT_DEATH] + a[REACT_FEED] + a[REACT_BITE];
+}
+
+/* Bring node n's firing time up to date at time now. A node that just fired
+   draws afresh; any other keeps its pending time, rescaled to the new
+   propensity, which leaves the process exact. */
+void refreshReaction(int n, double now, int fired) {
+    double a[NUM_REACTIONS];
+    double rate = nodePropensities(n, a);
+    double t;
+
+    if(rate <= 0.0 && reactionTime[n] == INFINITY) return;  /* Still idle */
+    if(rate <= 0.0) t = INFINITY;
+    else if(fired || reactionTime[n] == INFINITY) t = now - log(rngOpenDouble(&simRng)) / rate;
+    else t = now + (reactionRate[n] / rate) * (reactionTime[n] - now);
+
+    reactionRate[n] = rate;
+    reactionTime[n] = t;
+    siftReaction(reactionPos[n]);
+}
+
+/* A mosquito at node n, each equally likely: its compartment */
+int pickCompartment(int n) {
+    int u = (int)rngBelow(&simRng, swarmTotal(n));
+    int comp = 0;
+    while(u >= swarmCount(n, comp)) u -= swarmCount(n, comp++);
+    return comp;
+}
+
+/* Carry out the next event at node n */
+void fireReaction(int n) {
+    Rng *r = &simRng;
+    double now = reactionTime[n];
+    double a[NUM_REACTIONS];
+    double u = rngDouble(r) * nodePropensities(n, a);
+    int c = 0;
+    while(c < NUM_REACTIONS - 1 && (u >= a[c] || a[c] <= 0.0)) u -= a[c++];
+    while(a[c] <= 0.0) c--;  /* Rounding ran past the last live channel */
+
+    if(c == REACT_MOVE) {
+        int comp = pickCompartment(n);
+        int currentHour = hour % HOURS_PER_DAY;
+        int net = (currentHour > 18 || currentHour < 6) ? (rngDouble(r) < 0.5 ? 0 : 1) : 2;
+        int to  = selectDestination(r, net, &nodes[n]);
+        /* Netted houses are never destinations, so nothing has to be evicted */
+        if(to >= 0 && nodeIndex(net, to) != n) {
+            addSwarm(n, comp, -1);
+            addSwarm(nodeIndex(net, to), comp, 1);
+            refreshReaction(nodeIndex(net, to), now, 0);
+        }
+    } else if(c == REACT_DEATH) {
+        addSwarm(n, pickCompartment(n), -1);
+    } else if(c == REACT_FEED) {
+        addSwarm(n, SWARM_S, -1);
+        addSwarm(n, SWARM_E + day % cohortDays, 1);
+    } else {
+        int itnTargets = biteHumans(&workers[0], r, &nodes[n], 1);
+        if(itnTargets > 0 && rngDouble(r) < 1.0 - pow(1.0 - params.itnKillProb, itnTargets)) {
+            addSwarm(n, SWARM_I, -1);
+        }
+        createSplitHumans();
+    }
+    refreshReaction(n, now, 1);
+}
+
+/* Human departures at the top of the hour, done in place, with the
+   propensities of the nodes they leave and join brought up to date */
+void moveHumansForReactions() {
+    int hourOfWeek = hour % HOURS_PER_WEEK;
+    int begin = wheelStart[hourOfWeek], end = wheelStart[hourOfWeek + 1];
+
+    for(int k=begin; k<end + numWheelPending; k++){
+        int i = k < end ? wheelHumans[k] : wheelPending[k - end];
+        if(humans.state[i] == STATE_DEAD) continue;
+        int net, node;
+        if(!humanTarget(i, hourOfWeek, &net, &node)) continue;
+
+        int from = nodeIndex(humans.net[i], humans.node[i]);
+        moveHuman(i, net, node);
+        refreshReaction(from, hour, 0);
+        refreshReaction(nodeIndex(net, node), hour, 0);
+    }
+}
+
+void runReactionDay() {
+    /* The daily step changed counts everywhere */
+    for(int n=0; n<numNodes; n++) refreshReaction(n, hour, 0);
+
+    for(int h=0; h<HOURS_PER_DAY; h++){
+        moveHumansForReactions();
+        while(reactionTime[reactionHeap[0]] < hour + 1) fireReaction(reactionHeap[0]);
+        hour++;
+    }
+}
+
+/* Hours a step starting at hour of day h may span, at most maxHours: up to
+   the next hour at which a human departs, night and day switch (they pick
+   different destinations) or the day ends */
+int stepLength(int h, int maxHours) {
+    int len = 1;
+    while(len < maxHours && h + len < HOURS_PER_DAY) {
+        int hourOfWeek = (hour + len) % HOURS_PER_WEEK;
+        if(h + len == 6 || h + len == 19) break;
+        if(wheelStart[hourOfWeek + 1] > wheelStart[hourOfWeek] || pendingDepartures[hourOfWeek] > 0) break;
+        len++;
+    }
+    return len;
+}
+
+void runLeapDay() {
+    for(int h=0; h<HOURS_PER_DAY; ){
+        int len = stepLength(h, params.leapHours);
+        stepMoveProb = 1.0 - pow(1.0 - params.mosqMoveChance, len);
+        stepBiteProb = 1.0 - pow(1.0 - hourlyBitingProb, len);
+
+        scheduleMovement();
+        handleInfections();
+        hour += len;
+        h    += len;
+    }
+}
+
+double exposureHours;  /* Length of the window exposePhase() integrates over */
+int    exposureKey;    /* Its unitRng() phase */
+
+/* Exposure at node n over exposureHours, the swarm standing still. Each
+   hour the hourly model gives a susceptible mosquito a chance hbp * c *
+   weight of picking up the parasite, lets each susceptible human escape
+   the nI infectious mosquitoes with probability (1 - hbp * b)^nI, and kills
+   a biter on the nets of the humans it meets with probability hbp * pKill.
+   Over the window these compound in closed form, so one draw per
+   compartment and per human covers it. */
+void exposeSwarm(Worker *w, int n) {
+    Node *node = &nodes[n];
+    int nS = node->mosqStates[MSTATE_S];
+    int nI = node->mosqStates[MSTATE_I];
+    if(nS == 0 && nI == 0) return;
+    Rng *r = unitRng(w, exposureKey, n);
+    double hours = exposureHours;
+
+    int exposed = 0;
+    if(node->humanStates[STATE_I] > 0) {
+        double weight = fmin(1.0, infectiousWeight(node));
+        exposed = (int)rngBinomial(r, nS, 1.0 - pow(1.0 - hourlyBitingProb * params.cHumanToMos * weight, hours));
+    }
+
+    if(node->humanStates[STATE_S] > 0 && nI > 0) {
+        double bites = nI * hours;
+        double pOpen = 1.0 - pow(1.0 - hourlyBitingProb * params.bMosToHuman, bites);
+        double pNet  = 1.0 - pow(1.0 - hourlyBitingProb * params.bMosToHuman * (1.0 - params.itnEfficacy), bites);
+        int itnTargets = exposeHumans(w, r, node, pOpen, pNet);
+        if(itnTargets > 0) {
+            double pKill = 1.0 - pow(1.0 - params.itnKillProb, itnTargets);
+            addSwarm(n, SWARM_I, -(int)rngBinomial(r, nI, 1.0 - pow(1.0 - hourlyBitingProb * pKill, hours)));
+        }
+    }
+
+    if(exposed > 0) {
+        addSwarm(n, SWARM_S, -exposed);
+        addSwarm(n, SWARM_E + day % cohortDays, exposed);
+    }
+}
+
+void exposePhase(Worker *w) {
+    for(int k=0; k<w->numOwned; k++){
+        int n = w->owned[k];
+        if(nodes[n].humans.count > 0) exposeSwarm(w, n);
+    }
+}
+
+void runExposure(int key, double hours) {
+    exposureKey   = key;
+    exposureHours = hours;
+    runPhase(exposePhase);
+    createSplitHumans();
+}
+
+void runPhasedDay() {
+    for(int h=0; h<HOURS_PER_DAY; ){
+        int len = stepLength(h, HOURS_PER_DAY);
+
+        applyMoves(decideHumanMovesPhase);
+        runExposure(PHASE_INFECT, len / 2.0);
+        stepMoveProb = 1.0 - pow(1.0 - params.mosqMoveChance, len);
+        applyMoves(decideMosquitoMovesPhase);
+        runExposure(PHASE_INFECT_LATE, len / 2.0);
+
+        hour += len;
+        h    += len;
+    }
+}
+
+int main(int argc, char **argv){
+    if(!parseArgs(argc, argv) || !validateParams()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if(params.seed == 0) {
+        params.seed = (uint64_t)time(0);
+    }
+    printf("Seed: %llu\n", (unsigned long long)params.seed);
+    rngSeed(&simRng, params.seed, 0);
+
+    allocateSimulation();
+    initNetworks();
+    initPopulations();
+    startWorkers();
+    if(params.engine == ENGINE_NEXT_REACTION) startReactions();
+    openOutput();
+
+    /* Run simulation */
+    for(day=0; day<params.days; day++){
+        if(params.engine == ENGINE_NEXT_REACTION) {
+            runReactionDay();
+        } else if(params.engine == ENGINE_TAU_LEAP) {
+            runLeapDay();
+        } else if(params.engine == ENGINE_PHASED) {
+            runPhasedDay();
+        } else {
+            for(int h=0; h<HOURS_PER_DAY; h++){
+                scheduleMovement();
+                handleInfections();
+                hour++;
+            }
+        }
+        updateStates();
+        recordStats();
+    }
+    stopWorkers();
+
+    closeOutput();
 
     printf("Simulation complete.\n");
     return 0;
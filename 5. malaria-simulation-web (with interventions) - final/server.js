@@ -1,114 +1,146 @@
 const express = require('express');
-const { exec } = require('child_process');
+const { execFile } = require('child_process');
 const fs = require('fs');
+const os = require('os');
 const path = require('path');
 const bodyParser = require('body-parser');
 
 const app = express();
 const PORT = process.env.PORT || 3001;
 
+// The simulator reads its parameters at runtime, so it is compiled once at
+// startup (or whenever code.c is newer than the binary) instead of per request.
+const SOURCE_FILE = path.join(__dirname, 'code.c');
+const SIMULATOR = path.join(__dirname, 'simulation');
+// Worker threads per run; raise on machines with spare cores
+const SIM_THREADS = parseInt(process.env.SIM_THREADS) || 1;
+
+function buildSimulator() {
+    return new Promise((resolve, reject) => {
+        try {
+            const binStat = fs.statSync(SIMULATOR);
+            if (binStat.mtimeMs >= fs.statSync(SOURCE_FILE).mtimeMs) {
+                return resolve();
+            }
+        } catch (err) {
+            // No binary yet, fall through and compile it
+        }
+
+        console.log(`Compiling ${SOURCE_FILE}`);
+        execFile('gcc', ['-O2', '-pthread', SOURCE_FILE, '-o', SIMULATOR, '-lm'], (err, stdout, stderr) => {
+            if (err) {
+                return reject(new Error('Simulation compilation failed: ' + stderr));
+            }
+            resolve();
+        });
+    });
+}
+
+const simulatorReady = buildSimulator();
+simulatorReady.catch(err => console.error(err.message));
+
 // Middleware
 app.use(bodyParser.json());
 app.use(express.static(path.join(__dirname, 'public')));
 
 // API endpoint to run the simulation
 app.post('/api/run-simulation', (req, res) => {
-    const { 
-        humanPopulation, 
-        mosquitoPopulation, 
-        numHouses, 
-        temperature, 
+    const {
+        humanPopulation,
+        mosquitoPopulation,
+        numHouses,
+        temperature,
         numDays,
         // Simplified intervention parameters
         itnCoverage = 0,
         itnEfficacy = 0.7,
-        treatmentRate = 0
+        treatmentRate = 0,
+        // Optional: replay an earlier run exactly
+        seed,
+        // 'binary' returns results.bin as-is, see the Output section of code.c
+        format = 'csv'
     } = req.body;
-    
-    // Create a temporary C file with the modified parameters
-    const tempCFile = path.join(__dirname, 'temp_simulation.c');
-    const originalCFile = path.join(__dirname, 'code.c');
-    
-    // Read the original C file
-    fs.readFile(originalCFile, 'utf8', (err, data) => {
-        if (err) {
-            console.error('Error reading C file:', err);
-            return res.status(500).json({ error: 'Failed to read simulation code' });
-        }
-        
-        // Replace the parameters in the C code
-        let modifiedCode = data
-            .replace(/#define NUM_HUMANS\s+\d+/, `#define NUM_HUMANS        ${humanPopulation}`)
-            .replace(/#define NUM_MOSQUITOES\s+\d+/, `#define NUM_MOSQUITOES    ${mosquitoPopulation}`)
-            .replace(/#define NUM_HOUSES\s+\d+/, `#define NUM_HOUSES        ${numHouses}`)
-            .replace(/#define DAYS\s+\d+/, `#define DAYS              ${numDays}`);
-            
-        // Adjust mosquito parameters based on temperature
-        // This is a simple model - you might want to use a more sophisticated relationship
-        const bitingAdjustment = 0.3 * (1 + (temperature - 25) * 0.05);  // Increase biting at higher temps
-        const mortalityAdjustment = 0.1 * (1 - (temperature - 25) * 0.03);  // Decrease mortality at higher temps
-        
-        modifiedCode = modifiedCode
-            .replace(/#define DAILY_BITING_PROB\s+[\d\.]+/, `#define DAILY_BITING_PROB ${bitingAdjustment.toFixed(2)}`)
-            .replace(/#define MOSQ_MORTALITY\s+[\d\.]+/, `#define MOSQ_MORTALITY    ${mortalityAdjustment.toFixed(2)}`);
-        
-        // Update intervention parameters
-        modifiedCode = modifiedCode
-            .replace(/#define ITN_COVERAGE\s+[\d\.]+/, `#define ITN_COVERAGE      ${itnCoverage.toFixed(2)}`)
-            .replace(/#define ITN_EFFICACY\s+[\d\.]+/, `#define ITN_EFFICACY      ${itnEfficacy.toFixed(2)}`)
-            .replace(/#define TREATMENT_RATE\s+[\d\.]+/, `#define TREATMENT_RATE    ${treatmentRate.toFixed(2)}`);
-        
-        // Write the modified code to a temporary file
-        fs.writeFile(tempCFile, modifiedCode, (err) => {
+    const binary = format === 'binary';
+
+    const temp = Number(temperature);
+    if (temperature === undefined || temperature === null || !Number.isFinite(temp)) {
+        return res.status(400).json({ error: 'temperature must be a number' });
+    }
+
+    // Adjust mosquito parameters based on temperature
+    // This is a simple model - you might want to use a more sophisticated relationship
+    // The simulator only takes probabilities in [0, 1], so extreme temperatures saturate
+    const clampProbability = p => Math.min(1, Math.max(0, p));
+    const bitingAdjustment = clampProbability(0.3 * (1 + (temp - 25) * 0.05));  // Increase biting at higher temps
+    const mortalityAdjustment = clampProbability(0.1 * (1 - (temp - 25) * 0.03));  // Decrease mortality at higher temps
+
+    const args = [
+        '--humans', String(parseInt(humanPopulation)),
+        '--mosquitoes', String(parseInt(mosquitoPopulation)),
+        '--houses', String(parseInt(numHouses)),
+        '--days', String(parseInt(numDays)),
+        '--biting-prob', bitingAdjustment.toFixed(2),
+        '--mosq-mortality', mortalityAdjustment.toFixed(2),
+        '--itn-coverage', Number(itnCoverage).toFixed(2),
+        '--itn-efficacy', Number(itnEfficacy).toFixed(2),
+        '--treatment-rate', Number(treatmentRate).toFixed(2),
+        '--threads', String(SIM_THREADS)
+    ];
+    if (seed !== undefined) {
+        args.push('--seed', String(parseInt(seed)));
+    }
+    if (binary) {
+        args.push('--output-format', 'binary');
+    }
+
+    simulatorReady.then(() => {
+        // Each run writes its CSV files into its own directory so concurrent
+        // requests cannot overwrite each other's results
+        fs.mkdtemp(path.join(os.tmpdir(), 'malaria-run-'), (err, runDir) => {
             if (err) {
-                console.error('Error writing temporary C file:', err);
+                console.error('Error creating run directory:', err);
                 return res.status(500).json({ error: 'Failed to prepare simulation' });
             }
-            
-            // Compile and run the C program with proper path handling
-            const compileCmd = `gcc "${tempCFile}" -o "${path.join(__dirname, 'temp_simulation')}" -lm`;
-            const runCmd = `"${path.join(__dirname, 'temp_simulation')}"`;
-            
-            console.log(`Executing: ${compileCmd} && ${runCmd}`);
-            
-            // First compile
-            exec(compileCmd, (compileErr, stdout, stderr) => {
-                if (compileErr) {
-                    console.error('Error compiling simulation:', compileErr);
-                    return res.status(500).json({ error: 'Simulation compilation failed: ' + stderr });
+
+            console.log(`Executing: ${SIMULATOR} ${args.join(' ')}`);
+
+            execFile(SIMULATOR, args, { cwd: runDir }, (runErr, stdout, stderr) => {
+                const cleanup = () => fs.rm(runDir, { recursive: true, force: true }, () => {});
+
+                if (runErr) {
+                    cleanup();
+                    console.error('Error running simulation:', runErr);
+                    return res.status(500).json({ error: 'Simulation execution failed: ' + stderr });
                 }
-                
-                // Then run if compilation succeeded
-                exec(runCmd, { cwd: __dirname }, (runErr, stdout, stderr) => {
-                    // Clean up the temporary files
-                    fs.unlink(tempCFile, () => {});
-                    fs.unlink(path.join(__dirname, 'temp_simulation'), () => {});
-                    
-                    if (runErr) {
-                        console.error('Error running simulation:', runErr);
-                        return res.status(500).json({ error: 'Simulation execution failed: ' + stderr });
-                    }
-                    
-                    console.log('Simulation output:', stdout);
-                    
-                    // Read the CSV files
-                    try {
-                        const globalStats = fs.readFileSync(path.join(__dirname, 'global_stats.csv'), 'utf8');
-                        const houseStats = fs.readFileSync(path.join(__dirname, 'house_infected.csv'), 'utf8');
-                        
-                        // Send the data back to the client
-                        res.json({
-                            success: true,
-                            globalStats,
-                            houseStats
-                        });
-                    } catch (readErr) {
-                        console.error('Error reading CSV files:', readErr);
-                        res.status(500).json({ error: 'Failed to read simulation results' });
+
+                console.log('Simulation output:', stdout);
+
+                // Read the results
+                try {
+                    if (binary) {
+                        const results = fs.readFileSync(path.join(runDir, 'results.bin'));
+                        return res.type('application/octet-stream').send(results);
                     }
-                });
+
+                    const globalStats = fs.readFileSync(path.join(runDir, 'global_stats.csv'), 'utf8');
+                    const houseStats = fs.readFileSync(path.join(runDir, 'house_infected.csv'), 'utf8');
+
+                    // Send the data back to the client
+                    res.json({
+                        success: true,
+                        globalStats,
+                        houseStats
+                    });
+                } catch (readErr) {
+                    console.error('Error reading simulation results:', readErr);
+                    res.status(500).json({ error: 'Failed to read simulation results' });
+                } finally {
+                    cleanup();
+                }
             });
         });
+    }).catch(err => {
+        res.status(500).json({ error: err.message });
     });
 });
 
@@ -120,6 +152,5 @@ app.get('/api/status', (req, res) => {
 // Start the server
 app.listen(PORT, () => {
     console.log(`Server running on port ${PORT}`);
-    console.log(`Original C file path: ${path.join(__dirname, 'code.c')}`);
-    console.log(`Verify this file exists before running simulations`);
-}); 
\ No newline at end of file
+    console.log(`Simulator binary: ${SIMULATOR}`);
+});